@@ -340,6 +340,8 @@ struct PGASUS_EXPORT IgnorePlacement {
 	inline Node operator()(const iterator_type &) { return numa::Node(); }
 };
 
+// places elements on the node of the MemSource that holds them, found
+// through the address map without touching the element's memory
 struct PGASUS_EXPORT MemSourceCreationPlacement {
 	template <class iterator_type>
 	inline Node operator()(const iterator_type &it) {
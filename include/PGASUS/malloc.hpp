@@ -35,6 +35,7 @@ using PlaceStack = std::vector<Place>;
 static constexpr size_t MEM_PAGE_SIZE = 4096;
 
 PGASUS_MSOURCE_EXPORT void push(const Place &p);
+PGASUS_MSOURCE_EXPORT void push(Place &&p);
 PGASUS_MSOURCE_EXPORT void push_all(const PlaceStack &places);
 
 PGASUS_MSOURCE_EXPORT Place pop();
@@ -43,13 +44,12 @@ PGASUS_MSOURCE_EXPORT PlaceStack pop_all();
 PGASUS_MSOURCE_EXPORT MemSource curr_msource();
 }
 
+// the place stack holds the only reference to the guard's MemSource
 class PGASUS_MSOURCE_EXPORT PlaceGuard {
-private:
-	Place       _place;
 public:
-	explicit inline PlaceGuard(const Node &node) : _place(node) { malloc::push(_place); }
-	explicit inline PlaceGuard(const MemSource &ms) : _place(ms) { malloc::push(_place); }
-	explicit inline PlaceGuard(const Place &p) : _place(p) { malloc::push(_place); }
+	explicit inline PlaceGuard(const Node &node) { malloc::push(Place(node)); }
+	explicit inline PlaceGuard(const MemSource &ms) { malloc::push(Place(ms)); }
+	explicit inline PlaceGuard(const Place &p) { malloc::push(p); }
 	inline ~PlaceGuard() { malloc::pop(); }
 };
 
@@ -15,11 +15,72 @@ extern "C" {
  */
 PGASUS_MSOURCE_EXPORT void *callMmap(size_t sz, int node);
 
+/**
+ * Allocate sz bytes from system, aligned to page_size bytes. If page_size is
+ * larger than the base page size, the region is backed by explicit huge pages
+ * (MAP_HUGETLB), or, if transparent is set, advised for transparent huge pages.
+ * sz must be a multiple of page_size. If node >= 0, bind to the given NUMA node
+ */
+PGASUS_MSOURCE_EXPORT void *callMmapPages(size_t sz, int node, size_t page_size, int transparent);
+
+/**
+ * Allocate sz bytes of base pages from system, aligned to align bytes (a power
+ * of two). If node >= 0, bind them to the given NUMA node
+ */
+PGASUS_MSOURCE_EXPORT void *callMmapAligned(size_t sz, int node, size_t align);
+
+/**
+ * Record the pages of the range p..p+sz in the global address map, as owned
+ * by owner (aligned to the base page size) and placed on the given NUMA node
+ * (-1 if unbound or interleaved). Overwrites previous entries
+ */
+PGASUS_MSOURCE_EXPORT void registerMemory(void *p, size_t sz, void *owner, int node);
+
+/**
+ * Like registerMemory, for the chunks of a region MemSource, whose pages are
+ * marked as region memory. Once the region is gone, the pages are registered
+ * again without owner, and stay marked until other memory is registered
+ * there. Returns 0, or -1 if the address map is out of memory
+ */
+PGASUS_MSOURCE_EXPORT int registerRegionMemory(void *p, size_t sz, void *owner, int node);
+
+/**
+ * Remove the pages of the range p..p+sz from the global address map
+ */
+PGASUS_MSOURCE_EXPORT void unregisterMemory(void *p, size_t sz);
+
+/**
+ * Owner of the registered range that contains p (which may point anywhere
+ * into it), or NULL. If node is given, the range's node is stored there.
+ * Lock-free, and safe for any address
+ */
+PGASUS_MSOURCE_EXPORT void *lookupMemory(const void *p, int *node);
+
+/**
+ * Whether p lies in pages registered by registerRegionMemory. Lock-free, and
+ * safe for any address
+ */
+PGASUS_MSOURCE_EXPORT int isRegionMemory(const void *p);
+
+/**
+ * Like lookupMemory, for count pointers at once. owners or nodes may be NULL
+ */
+PGASUS_MSOURCE_EXPORT void lookupMemory_n(size_t count, const void **ptrs, void **owners, int *nodes);
+
 /**
  * Bind memory region to given NUMA node. Returns mbind() return value.
  */
 PGASUS_MSOURCE_EXPORT int bindMemory(void *p, size_t sz, int node);
 
+/**
+ * Interleave the pages of a memory region across count NUMA nodes. If weights
+ * differ (may be NULL), consecutive runs of weights[i] * granule bytes are
+ * bound to node i, round-robin, so each node receives a share proportional to
+ * its weight. granule must be a multiple of the page size. Returns 0 on success
+ */
+PGASUS_MSOURCE_EXPORT int interleaveMemory(void *p, size_t sz, const int *nodes,
+	const unsigned *weights, size_t count, size_t granule);
+
 /**
  * Return NUMA node location of data pointed to by ptr, as returned by move_pages
  */
@@ -41,6 +102,18 @@ PGASUS_MSOURCE_EXPORT int moveMemory(void *p, size_t sz, int node);
  */
 PGASUS_MSOURCE_EXPORT void touchMemory(void *p, size_t sz);
 
+/**
+ * Like touchMemory, for a region backed by pages of page_size bytes
+ */
+PGASUS_MSOURCE_EXPORT void touchMemoryPages(void *p, size_t sz, size_t page_size);
+
+/**
+ * Like touchMemoryPages, but lets the kernel fault in the whole region at once
+ * (MADV_POPULATE_WRITE), if it supports that. Contents are not changed, even
+ * if other threads write to the region meanwhile
+ */
+PGASUS_MSOURCE_EXPORT void populateMemory(void *p, size_t sz, size_t page_size);
+
 
 #ifdef __cplusplus
 }  /* extern "C" */
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdio>
+#include <functional>
 #include <string>
+#include <vector>
 #include "PGASUS/base/node.hpp"
 #include "PGASUS/msource/PGASUS_msource_export.h"
 
@@ -10,6 +13,9 @@ namespace msource {
 class MemSourceImpl;
 }
 
+// allocation size classes: <= 16 B, <= 32 B, ..., <= 256 KiB, larger
+static constexpr size_t MSOURCE_SIZE_CLASSES = 16;
+
 struct PGASUS_MSOURCE_EXPORT msource_info
 {
 	size_t hugeobj_count;
@@ -19,10 +25,79 @@ struct PGASUS_MSOURCE_EXPORT msource_info
 	size_t arena_count;
 	size_t arena_used;
 	size_t arena_size;
+	size_t arena_released;  // bytes returned to the OS by trimming, in total
+
+	size_t slab_count;      // segments holding small blocks without footer
+	size_t slab_used;       // bytes of spans carved into small blocks
+	size_t slab_size;       // bytes of small blocks handed out, incl. thread caches
+	size_t slab_released;   // bytes of unused spans returned to the OS, in total
+
+	size_t region_count;    // chunks of a region, see MemSource::createRegion()
+	size_t region_used;     // bytes of these chunks
+	size_t region_size;     // bytes handed out since the last reset
+
+	size_t alloc_count;
+	size_t free_count;
+	size_t remote_free_count;  // frees from threads on another node
+	size_t live_bytes;         // usable bytes of the allocated blocks
+	size_t peak_bytes;         // high-water mark of bytes handed out, incl. thread caches
+	size_t alloc_size_classes[MSOURCE_SIZE_CLASSES];  // allocations by requested size
+
+	size_t node_count;         // nodes the memory is placed on, 0 if unbound
+};
+
+/**
+ * How a MemSource sizes the arenas it adds once its memory is exhausted: the
+ * first one has min_arena bytes, each further one factor times the previous
+ * one's, up to max_arena. Arenas used up quickly make the next one grow by
+ * factor twice, ones that lasted long make it stay the same. Arenas added
+ * because the others are busy, not full, don't grow either
+ */
+struct PGASUS_MSOURCE_EXPORT msource_growth
+{
+	size_t min_arena;
+	size_t max_arena;
+	size_t factor;
+};
+
+struct PGASUS_MSOURCE_EXPORT msource_snapshot
+{
+	char description[128];
+	int node;
+	msource_info info;
+};
+
+/**
+ * Call stack of sampled allocations, see MemSource::setTraceSampling()
+ */
+struct PGASUS_MSOURCE_EXPORT msource_trace_site
+{
+	static constexpr size_t MAX_FRAMES = 8;
+
+	size_t frame_count;
+	void *frames[MAX_FRAMES];  // return addresses, innermost first
+	size_t samples;            // sampled allocations from this call stack
+	size_t remote_samples;     // ... placed on another node than the allocating thread's
+	size_t est_bytes;          // bytes allocated, estimated from the samples
+	size_t live_samples;       // sampled blocks not yet freed
+	size_t live_est_bytes;     // bytes of these blocks, estimated
 };
 
 static constexpr size_t MEM_PAGE_SIZE = 4096;
 
+/**
+ * Pages backing the memory of a MemSource. Once the hugetlbfs pool is
+ * exhausted, explicit huge pages fall back to base pages, aligned alike
+ */
+enum class PageSize {
+	Default,      // base pages (MEM_PAGE_SIZE)
+	Transparent,  // base pages, 2 MiB aligned and advised for transparent huge pages
+	Huge2M,       // explicit 2 MiB pages from the hugetlbfs pool
+	Huge1G,       // explicit 1 GiB pages from the hugetlbfs pool
+};
+
+class MemSourceRef;
+
 class PGASUS_MSOURCE_EXPORT MemSource
 {
 private:
@@ -31,6 +106,8 @@ private:
 	
 	explicit MemSource(msource::MemSourceImpl *ms);
 
+	friend class MemSourceRef;
+
 public:
 	MemSource();
 	MemSource(const MemSource &other);
@@ -43,15 +120,61 @@ public:
 	bool operator==(const MemSource &other) const { return _msource == other._msource; }
 	bool operator!=(const MemSource &other) const { return _msource != other._msource; }
 
-	static MemSource create(int phys_node, size_t sz, const char *str, int phys_home_node = -1);
+	static MemSource create(int phys_node, size_t sz, const char *str, int phys_home_node = -1,
+		PageSize pages = PageSize::Default);
+
+	/**
+	 * Create a MemSource whose memory is interleaved across the given nodes.
+	 * If weights are given (one per node, e.g. memory bandwidth or capacity),
+	 * each node receives a share of the pages proportional to its weight.
+	 */
+	static MemSource createInterleaved(const NodeList &nodes, size_t sz, const char *str,
+		const std::vector<size_t> &weights = std::vector<size_t>(),
+		PageSize pages = PageSize::Default);
 	static const MemSource& global();
+
+	/**
+	 * Node-global MemSource of the given node, created on first use. Invalid
+	 * for node IDs beyond the machine's
+	 */
 	static const MemSource& forNode(size_t phys_node);
 
+	/**
+	 * Create a region for phase-scoped data: blocks are bumped from chunks of
+	 * chunk_sz bytes, free() ignores them, and reset() discards all of them at
+	 * once. The blocks don't keep the region alive, its memory is returned as
+	 * soon as the last MemSource handle is gone
+	 */
+	static MemSource createRegion(int phys_node, size_t chunk_sz, const char *str,
+		PageSize pages = PageSize::Default);
+
 	void* alloc(size_t sz) const;
+
+	/**
+	 * Like alloc(), but the memory is zeroed. Blocks from untouched memory are
+	 * known to be zero and are not cleared, so that their pages are not
+	 * faulted in by the calling thread.
+	 */
+	void* allocZeroed(size_t sz) const;
 	void* allocAligned(size_t align, size_t sz) const;
 	static void free(void *p);
+
+	/**
+	 * Like free(), for callers that know the size of the block (as requested
+	 * from alloc(), allocAligned() or the last resize()). This spares looking
+	 * up aligned blocks' actual chunk, and the headers of small blocks
+	 */
+	static void freeSized(void *p, size_t sz);
+	static void freeAlignedSized(void *p, size_t align, size_t sz);
 	static size_t allocatedSize(void *p);
 
+	/**
+	 * Resizes the block without copying it: in place within its arena, or by
+	 * remapping the pages of an mmapped block. Returns the block's new address,
+	 * or nullptr if it has to be copied by the caller
+	 */
+	static void* resize(void *p, size_t sz);
+
 	template <class T, class ... Args>
 	inline T* construct(Args&&... args) const {
 		return new (alloc(sizeof(T))) T(std::forward<Args>(args)...);
@@ -66,7 +189,7 @@ public:
 	static void destruct(T* &ptr) {
 		if (ptr != nullptr) {
 			ptr->~T();
-			free((void*)ptr);
+			freeSized((void*)ptr, sizeof(T));
 			ptr = nullptr;
 		}
 	}
@@ -75,32 +198,140 @@ public:
 	static void destructNoRef(T* ptr) {
 		if (ptr != nullptr) {
 			ptr->~T();
-			free((void*)ptr);
+			freeSized((void*)ptr, sizeof(T));
 		}
 	}
 
 	int getPhysicalNode() const;
+	PageSize getPageSize() const;
 	Node getLogicalNode() const;
+
+	/**
+	 * Called during migrate() after each batch, with the number of bytes
+	 * moved so far and the total number of bytes to move
+	 */
+	typedef std::function<void(size_t done, size_t total)> MigrateProgress;
+
+	/**
+	 * Moves the memory to the given node, in batches of contiguous ranges.
+	 * Allocations may proceed in between: memory mapped once the migration
+	 * has started comes from the new node, blocks from memory not moved yet
+	 * follow along with it. An interleaved MemSource stays on the new node.
+	 * Returns the size of all ranges bound to the node, in pages of
+	 * getPageSize(), touched or not
+	 */
 	size_t migrate(int phys_dst) const;
+	size_t migrate(int phys_dst, const MigrateProgress &progress) const;
 
+	/**
+	 * Node of the memory that p points to, which may lie anywhere within a
+	 * block. Invalid for memory of no MemSource
+	 */
 	template <class T> static Node nodeOf(T *p) { return getNodeOf((void*) p); }
 
+	/**
+	 * Like nodeOf, for count pointers at once
+	 */
+	static void getNodesOf(const void **ptrs, size_t count, Node *nodes);
+
 	std::string getDescription() const;
 	struct msource_info stats() const;
 
+	/**
+	 * Statistics of all existing MemSources. Allocations carry on meanwhile,
+	 * so the counters of different sources are not from the same instant
+	 */
+	static std::vector<msource_snapshot> snapshotAll();
+
+	/**
+	 * Allocation tracing for all MemSources: about once every sample_bytes
+	 * allocated bytes, the allocation's call stack is recorded, along with
+	 * whether the block was placed on another node than the allocating
+	 * thread's. 0 disables tracing. The NUMA_TRACE_SAMPLE environment variable
+	 * sets the initial interval. While tracing, a source reports its live
+	 * sampled blocks to stderr when its last reference is dropped
+	 */
+	static void setTraceSampling(size_t sample_bytes);
+
+	// call stacks of the source's sampled allocations
+	std::vector<msource_trace_site> traceSites() const;
+
+	/**
+	 * Prints the call stacks of the source's sampled allocations, by live
+	 * bytes. Returns the number of call stacks printed
+	 */
+	size_t traceReport(FILE *out) const;
+
 	bool valid() const { return _msource != nullptr; }
 
-	static MemSource create(Node node, size_t sz, const char *str, const Node& home_node = Node()) {
-		return create(node.physicalId(), sz, str, home_node.physicalId());
+	static MemSource create(Node node, size_t sz, const char *str, const Node& home_node = Node(),
+			PageSize pages = PageSize::Default) {
+		return create(node.physicalId(), sz, str, home_node.physicalId(), pages);
 	}
 	static const MemSource& forNode(const Node &node) {
 		return forNode(node.physicalId());
 	}
+	static MemSource createRegion(const Node &node, size_t chunk_sz, const char *str,
+			PageSize pages = PageSize::Default) {
+		return createRegion(node.physicalId(), chunk_sz, str, pages);
+	}
 	size_t migrate(const Node& node) const {
 		return migrate(node.physicalId());
 	}
 
 	size_t prefault(size_t bytes);
+
+	// return unused arena memory to the OS. Returns the number of bytes released
+	size_t trim() const;
+
+	/**
+	 * Growth policy of new MemSources: 4 MiB, 1 GiB and factor 2, unless set
+	 * by the NUMA_ARENA_MIN, NUMA_ARENA_MAX and NUMA_ARENA_FACTOR environment
+	 * variables. The built-in sources start out with min_arena bytes
+	 */
+	static const msource_growth& defaultGrowth();
+	msource_growth getGrowth() const;
+	void setGrowth(const msource_growth &growth) const;
+
+	/**
+	 * Regions only: discards all blocks at once. The chunks stay mapped, with
+	 * their pages faulted in, for the next blocks. Must not overlap with
+	 * allocations from the region. Returns the number of bytes handed out
+	 * since the last reset
+	 */
+	size_t reset() const;
+};
+
+/**
+ * Borrowed handle to a MemSource, for hot paths: unlike MemSource, copying
+ * it does not touch the source's reference count. A MemSource must keep the
+ * source alive for as long as the handle is used.
+ */
+class PGASUS_MSOURCE_EXPORT MemSourceRef
+{
+private:
+	msource::MemSourceImpl *_msource;
+
+public:
+	MemSourceRef() : _msource(nullptr) {}
+	MemSourceRef(const MemSource &ms) : _msource(ms._msource) {}
+
+	bool operator==(const MemSourceRef &other) const { return _msource == other._msource; }
+	bool operator!=(const MemSourceRef &other) const { return _msource != other._msource; }
+
+	void* alloc(size_t sz) const;
+	void* allocZeroed(size_t sz) const;
+	void* allocAligned(size_t align, size_t sz) const;
+
+	template <class T, class ... Args>
+	inline T* construct(Args&&... args) const {
+		return new (alloc(sizeof(T))) T(std::forward<Args>(args)...);
+	}
+
+	bool valid() const { return _msource != nullptr; }
+
+	// an owning MemSource for the source
+	MemSource msource() const { return MemSource(_msource); }
 };
 
 }
@@ -32,14 +32,14 @@ public:
 public:
 	MemSourceAllocator(const MemSource &m) : ms(m) {}
 	template <class U> MemSourceAllocator(const MemSourceAllocator<U> &other) : ms(other.ms) {}
-	template <class U> MemSourceAllocator(MemSourceAllocator<U> &&other) : ms(other.ms) {}
+	template <class U> MemSourceAllocator(MemSourceAllocator<U> &&other) : ms(std::move(other.ms)) {}
 	
 	~MemSourceAllocator() {}
 	
 	template <class U> MemSourceAllocator& operator=(const MemSourceAllocator<U>& other) {
 		ms = other.ms; return *this; }
 	template <class U> MemSourceAllocator& operator=(MemSourceAllocator<U>&& other) {
-			ms = other.ms; return *this; }
+			ms = std::move(other.ms); return *this; }
 	
 public:
 	inline const MemSource& msource() const { return ms; }
@@ -53,7 +53,7 @@ public:
 	}
 	
 	inline void deallocate(pointer p, size_type n) {
-		ms.free(static_cast<void_pointer>(p));
+		ms.freeSized(static_cast<void_pointer>(p), sizeof(T) * n);
 	}
 	
 	template<typename... Args>
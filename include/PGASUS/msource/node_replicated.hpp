@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <mutex>
+#include <new>
 #include <cassert>
 #include <cstring>
 
@@ -21,17 +23,17 @@ class NodeReplicated
 	private:
 		LockType                _global_lock;
 		size_t                  _logical_node_count = 0;
-		T**                     _global_data = nullptr;
+		std::atomic<T*>*        _global_data = nullptr;	// read without the lock
 	
 	public:
 		NodeReplicated() {
 			_logical_node_count = NodeList::logicalNodesCount();
-			_global_data = (T**) MemSource::global().allocAligned(
-				64, _logical_node_count * sizeof(T*));
+			_global_data = (std::atomic<T*>*) MemSource::global().allocAligned(
+				64, _logical_node_count * sizeof(std::atomic<T*>));
 			
 			// zero out
 			for (size_t i = 0; i < _logical_node_count; i++)
-				_global_data[i] = nullptr;
+				new (&_global_data[i]) std::atomic<T*>(nullptr);
 		}
 		
 		~NodeReplicated() {
@@ -39,9 +41,10 @@ class NodeReplicated
 			
 			// Destroy NodeLocalStorage instances + return mem
 			for (size_t i = 0; i < _logical_node_count; i++) {
-				if (_global_data[i] != nullptr) {
-					_global_data[i]->~T();
-					MemSource::free((void*) _global_data[i]);
+				T *data = _global_data[i].load(std::memory_order_relaxed);
+				if (data != nullptr) {
+					data->~T();
+					MemSource::free((void*) data);
 				}
 			}
 			MemSource::free((void*) _global_data);
@@ -52,16 +55,29 @@ class NodeReplicated
 			size_t n = node.logicalId();
 			assert(n < _logical_node_count);
 			
-			if (_global_data[n] == nullptr) {
+			T *data = _global_data[n].load(std::memory_order_acquire);
+			if (data == nullptr) {
 				// make sure to allocate only once
 				std::lock_guard<LockType> lock(_global_lock);
-				if (_global_data[n] == nullptr) {
-					_global_data[n] = new (MemSource::forNode(
+				data = _global_data[n].load(std::memory_order_relaxed);
+				if (data == nullptr) {
+					data = new (MemSource::forNode(
 						node.physicalId()).allocAligned(64, sizeof(T))) T(node);
+					_global_data[n].store(data, std::memory_order_release);
 				}
 			}
 			
-			return *_global_data[n];
+			return *data;
+		}
+		
+		/**
+		 * Return the instance for the given node, or null if none was created yet
+		 */
+		T *try_get(const Node& node) {
+			assert(node.valid());
+			size_t n = node.logicalId();
+			assert(n < _logical_node_count);
+			return _global_data[n].load(std::memory_order_acquire);
 		}
 		
 		std::vector<T*> get_all_registered() {
@@ -71,8 +87,9 @@ class NodeReplicated
 			ret.reserve(_logical_node_count);
 			
 			for (size_t i = 0; i < _logical_node_count; i++) {
-				if (_global_data[i] != nullptr) 
-					ret.push_back(_global_data[i]);
+				T *data = _global_data[i].load(std::memory_order_relaxed);
+				if (data != nullptr)
+					ret.push_back(data);
 			}
 			
 			return std::move(ret);
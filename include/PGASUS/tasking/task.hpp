@@ -1,7 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <list>
 #include <cstdint>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #include "PGASUS/base/spinlock.hpp"
 #include "PGASUS/base/ref_ptr.hpp"
@@ -141,6 +146,17 @@ private:
 	
 public:
 	
+	/**
+	 * Task objects for the calling worker's own node come from that worker's
+	 * pool of node-local memory, others from malloc(). Either way, they are
+	 * aligned to MAX_ALIGN bytes
+	 */
+	static constexpr size_t MAX_ALIGN = 16;
+	static void* operator new(size_t sz, const Node &node);
+	static void* operator new(size_t sz);
+	static void operator delete(void *p, const Node &node);
+	static void operator delete(void *p);
+	
 	Node node() const;
 	int cpuid() const;
 	
@@ -171,39 +187,53 @@ template <class T>
 using TaskFunction = std::function<T()>;
 
 
+template <class T, class F>
+class CallableTask;
+
+
 /**
- * Class that executes a function returning type T
+ * Class that executes a function returning type T. The result is stored
+ * within the task.
  */
 template <class T>
 class FunctionTask : public Task
 {
 private:
-	TaskFunction<T>             _function;
-	T                          *_result;
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type _result;
+	bool                        _has_result;
 	
 protected:
-	virtual void do_run() override {
-		assert(_result == nullptr);
-		_result = new T(_function());
+	template <class F>
+	inline void run_function(F &fun) {
+		assert(!_has_result);
+		new (&_result) T(fun());
+		_has_result = true;
 	}
 
-	FunctionTask(const TaskFunction<T> &fun, Priority prio)
-		: Task(prio), _function(fun), _result(nullptr)
+	explicit FunctionTask(Priority prio)
+		: Task(prio), _has_result(false)
 	{
 	}
 	
 	virtual ~FunctionTask() { 
-		if (_result != nullptr) delete _result;
+		if (_has_result) reinterpret_cast<T*>(&_result)->~T();
 	}
 
 public:
 	inline T get() const {
 		assert(state() == COMPLETED);
-		return *_result;
+		return *reinterpret_cast<const T*>(&_result);
 	}
 	
-	static FunctionTask* create(const TaskFunction<T> &fun, Priority prio) {
-		return new FunctionTask(fun, prio);
+	/**
+	 * Create a task that runs the given callable, which is stored within
+	 * the task. Memory comes from node, if valid
+	 */
+	template <class F>
+	static FunctionTask* create(F &&fun, Priority prio, const Node &node = Node()) {
+		typedef CallableTask<T, typename std::decay<F>::type> Impl;
+		static_assert(alignof(Impl) <= Task::MAX_ALIGN, "callable or result is over-aligned for a task");
+		return new (node) Impl(std::forward<F>(fun), prio);
 	}
 };
 
@@ -215,23 +245,87 @@ template <>
 class FunctionTask<void> : public Task
 {
 protected:
-	TaskFunction<void>          _function;
-	
-	FunctionTask(const TaskFunction<void> &fun, Priority prio)
-		: Task(prio), _function(fun)
+	template <class F>
+	inline void run_function(F &fun) {
+		fun();
+	}
+
+	explicit FunctionTask(Priority prio)
+		: Task(prio)
 	{
 	}
 		
 	virtual ~FunctionTask() {}
+
+public:
 	
+	template <class F>
+	static FunctionTask* create(F &&fun, Priority prio, const Node &node = Node()) {
+		typedef CallableTask<void, typename std::decay<F>::type> Impl;
+		static_assert(alignof(Impl) <= Task::MAX_ALIGN, "callable is over-aligned for a task");
+		return new (node) Impl(std::forward<F>(fun), prio);
+	}
+};
+
+
+/**
+ * FunctionTask holding a callable of type F
+ */
+template <class T, class F>
+class CallableTask final : public FunctionTask<T>
+{
+private:
+	F                           _function;
+	
+	template <class U> friend class FunctionTask;
+
+	template <class G>
+	CallableTask(G &&fun, Priority prio)
+		: FunctionTask<T>(prio), _function(std::forward<G>(fun))
+	{
+	}
+
+protected:
 	virtual void do_run() override {
-		_function(); 
+		this->run_function(_function);
 	}
+};
+
+
+/**
+ * Task that migrates a MemSource to another node. Can be waited upon like any
+ * other task, and reports the progress of the migration while running.
+ */
+class PGASUS_EXPORT MigrationTask : public Task
+{
+private:
+	MemSource                   _msource;
+	int                         _dst;
+	std::atomic_size_t          _bytes_done;
+	std::atomic_size_t          _bytes_total;
+	size_t                      _pages;
+
+protected:
+	virtual void do_run() override;
+
+	MigrationTask(const MemSource &msource, int phys_dst, Priority prio);
+
+	virtual ~MigrationTask() {}
 
 public:
-	
-	static FunctionTask* create(const TaskFunction<void> &fun, Priority prio) {
-		return new FunctionTask(fun, prio);
+	inline size_t bytes_done() const { return _bytes_done; }
+	inline size_t bytes_total() const { return _bytes_total; }
+
+	/**
+	 * Number of pages that have been migrated
+	 */
+	inline size_t get() const {
+		assert(state() == COMPLETED);
+		return _pages;
+	}
+
+	static MigrationTask* create(const MemSource &msource, int phys_dst, Priority prio) {
+		return new MigrationTask(msource, phys_dst, prio);
 	}
 };
 
@@ -240,5 +334,7 @@ public:
 template <class T>
 using TaskRef = numa::RefPtr<tasking::FunctionTask<T>>;
 
+using MigrationRef = numa::RefPtr<tasking::MigrationTask>;
+
 }
 
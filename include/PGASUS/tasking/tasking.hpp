@@ -1,6 +1,7 @@
 #pragma once
 
 #include <list>
+#include <utility>
 
 #include "PGASUS/base/node.hpp"
 #include "PGASUS/PGASUS_export.h"
@@ -26,6 +27,12 @@ PGASUS_EXPORT void yield();
  */
 PGASUS_EXPORT void prefaultWorkerThreadStorages(size_t bytes);
 
+/**
+ * Migrates the given MemSource to dst, within a task running on dst. The
+ * returned reference can be waited upon and reports the migration's progress
+ */
+PGASUS_EXPORT MigrationRef migrateAsync(const MemSource &msource, const Node &dst, Priority prio);
+
 /**
  * Waits for task completion and returns result
  */
@@ -40,17 +47,27 @@ T get_result(const TaskRef<T> &ref) {
 /**
  * Spawns a task that executes the specified function, return a Future<T> to
  * that task. This reference can be waited upon and the result value retrieved.
+ * A migratable task may be run by idle workers of neighbor nodes when the
+ * given node has a backlog (see NUMA_STEAL_NEIGHBORS, NUMA_STEAL_THRESHOLDS).
+ * The callable is stored within the task, without a std::function.
  */
-template <class T>
-TaskRef<T> async(const numa::tasking::TaskFunction<T> &fun, Priority prio, const Node &node = Node()) {
+template <class T, class F>
+TaskRef<T> async(F &&fun, Priority prio, const Node &node = Node(), bool migratable = false) {
 	if (node.valid()) numa::malloc::push(numa::Place(node));
-	TaskRef<T> task = tasking::FunctionTask<T>::create(fun, prio);
+	TaskRef<T> task = tasking::FunctionTask<T>::create(std::forward<F>(fun), prio, node);
 	if (node.valid()) numa::malloc::pop();
+	task->set_keep_scheduler(!migratable);
 
 	tasking::spawn_task(node, task.get());
 	return task;
 }
 
+template <class T>
+TaskRef<T> async(const numa::tasking::TaskFunction<T> &fun, Priority prio, const Node &node = Node(),
+		bool migratable = false) {
+	return async<T, const numa::tasking::TaskFunction<T>&>(fun, prio, node, migratable);
+}
+
 /**
  * Spawns the given task on each worker thread's task queue on all
  * the given nodes
@@ -935,6 +935,12 @@ DLMALLOC_EXPORT void mspace_free(mspace msp, void* mem);
 */
 DLMALLOC_EXPORT void* mspace_realloc(mspace msp, void* mem, size_t newsize);
 
+/*
+  mspace_realloc_in_place behaves as mspace_realloc, but never moves
+  the chunk. Returns mem, or null if it could not be resized in place.
+*/
+DLMALLOC_EXPORT void* mspace_realloc_in_place(mspace msp, void* mem, size_t newsize);
+
 /*
   mspace_calloc behaves as calloc, but operates within
   the given space.
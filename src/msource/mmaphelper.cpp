@@ -3,10 +3,18 @@
 #include <numaif.h>      /* for mbind */
 #include <numa.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cassert>
+#include <cerrno>
 #include <string.h>
 
+// since Linux 5.14
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
 
 /** 
  * Allocate sz bytes from system. If node >= 0, bind them to the given NUMA node
@@ -25,6 +33,84 @@ extern "C" void *callMmap(size_t sz, int node) {
 	return mem;
 }
 
+// over-allocate base pages, so that the region can be aligned
+static void *mmapAligned(size_t sz, size_t align) {
+	char *raw = (char*) mmap(0, sz + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) return 0;
+
+	char *aligned = (char*) (((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+	if (aligned > raw)
+		munmap(raw, aligned - raw);
+	if (raw + align > aligned)
+		munmap(aligned + sz, (raw + align) - aligned);
+
+	return aligned;
+}
+
+/**
+ * Allocate sz bytes from system, aligned to align bytes
+ */
+extern "C" void *callMmapAligned(size_t sz, int node, size_t align) {
+	if (align <= 4096) {
+		return callMmap(sz, node);
+	}
+
+	void *mem = mmapAligned(sz, align);
+	if (mem == 0) return 0;
+
+	if (node >= 0) {
+		bindMemory(mem, sz, node);
+	}
+
+	return mem;
+}
+
+/**
+ * Allocate sz bytes from system, aligned to and backed by pages of the given size
+ */
+extern "C" void *callMmapPages(size_t sz, int node, size_t page_size, int transparent) {
+	if (page_size <= 4096) {
+		return callMmap(sz, node);
+	}
+
+	int prot = PROT_READ | PROT_WRITE;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *mem;
+
+	if (transparent) {
+		mem = mmapAligned(sz, page_size);
+		if (mem == 0) return 0;
+		madvise(mem, sz, MADV_HUGEPAGE);
+	} else {
+		// MAP_HUGE_* encodes log2 of the page size
+		flags |= MAP_HUGETLB | ((__builtin_ctzll(page_size) & MAP_HUGE_MASK) << MAP_HUGE_SHIFT);
+		mem = mmap(0, sz, prot, flags, -1, 0);
+		if (mem == MAP_FAILED) return 0;
+	}
+
+	if (node >= 0) {
+		bindMemory(mem, sz, node);
+	}
+
+	return mem;
+}
+
+// node bit mask
+static constexpr size_t NODE_MASK_MAX = 1024;
+static constexpr size_t NODE_MASK_ITEM_SIZE = 8*sizeof(unsigned long);
+static constexpr size_t NODE_MASK_ITEMS = NODE_MASK_MAX / NODE_MASK_ITEM_SIZE;
+static_assert(NODE_MASK_ITEMS * NODE_MASK_ITEM_SIZE == NODE_MASK_MAX, "Invalid node mask size");
+
+// init bit mask - make sure to do no dynamic memory allocation here,
+// so the bitmask is stored on the caller's stack
+static inline void initNodeMask(unsigned long *nodemask, const int *nodes, size_t count) {
+	memset(nodemask, 0, NODE_MASK_ITEMS * sizeof(unsigned long));
+	for (size_t i = 0; i < count; i++) {
+		assert(nodes[i] >= 0 && nodes[i] < (int)NODE_MASK_MAX);
+		nodemask[nodes[i]/NODE_MASK_ITEM_SIZE] |= (1LL << (nodes[i]%NODE_MASK_ITEM_SIZE));
+	}
+}
+
 /**
  * Bind memory region to given NUMA node
  */
@@ -32,25 +118,244 @@ extern "C" int bindMemory(void *p, size_t sz, int node) {
 	int ret;
 	unsigned mflags = MPOL_MF_STRICT | MPOL_MF_MOVE;
 	
-	// node bit mask 
-	static constexpr size_t NODE_MASK_MAX = 1024;
-	static constexpr size_t ITEM_SIZE = 8*sizeof(unsigned long);
-	static constexpr size_t NODE_MASK_ITEMS = NODE_MASK_MAX / ITEM_SIZE;
-	static_assert(NODE_MASK_ITEMS * ITEM_SIZE == NODE_MASK_MAX, "Invalid node mask size");
-	
-	assert(node < (int)NODE_MASK_MAX);
-	
-	// init bit mask - make sure to do no dynamic memory allocation here, 
-	// so store the bitmask on the stack
 	unsigned long nodemask[NODE_MASK_ITEMS];
-	memset(nodemask, 0, NODE_MASK_ITEMS * sizeof(unsigned long));
-	nodemask[node/ITEM_SIZE] |= (1LL << (node%ITEM_SIZE));
+	initNodeMask(nodemask, &node, 1);
 	
 	ret = mbind(p, sz, MPOL_BIND, nodemask, NODE_MASK_MAX, mflags);
 	
 	return ret;
 }
 
+/**
+ * Interleave memory region across the given NUMA nodes
+ */
+extern "C" int interleaveMemory(void *p, size_t sz, const int *nodes, const unsigned *weights,
+		size_t count, size_t granule) {
+	unsigned mflags = MPOL_MF_STRICT | MPOL_MF_MOVE;
+	unsigned long nodemask[NODE_MASK_ITEMS];
+
+	bool weighted = false;
+	for (size_t i = 1; weights != nullptr && i < count; i++)
+		weighted |= (weights[i] != weights[0]);
+
+	if (!weighted) {
+		initNodeMask(nodemask, nodes, count);
+		return mbind(p, sz, MPOL_INTERLEAVE, nodemask, NODE_MASK_MAX, mflags);
+	}
+
+	// bind runs of weights[i] granules to node i, round-robin
+	char *curr = (char*) p;
+	char *end = curr + sz;
+	while (curr < end) {
+		for (size_t i = 0; i < count && curr < end; i++) {
+			if (weights[i] == 0) continue;
+
+			size_t len = std::min((size_t)(end - curr), weights[i] * granule);
+			initNodeMask(nodemask, &nodes[i], 1);
+			int ret = mbind(curr, len, MPOL_BIND, nodemask, NODE_MASK_MAX, mflags);
+			if (ret != 0) return ret;
+			curr += len;
+		}
+	}
+
+	return 0;
+}
+
+// The address map covers 48 bit addresses in granules of 2 MiB, through a
+// top table and lazily mapped mid tables. A granule's entry encodes the owner
+// (page-aligned), and node+1 and the region mark (bit 1) in the owner's low
+// bits. Granules shared by several ranges point to a leaf with one such entry
+// per base page, tagged by bit 0. Tables and leaves are never freed, so
+// lookups need no locking.
+namespace {
+
+typedef std::atomic<uintptr_t> MapEntry;
+
+constexpr size_t MAP_ADDRESS_BITS = 48;
+constexpr size_t MAP_PAGE_BITS = 12;
+constexpr size_t MAP_LEAF_BITS = 21 - MAP_PAGE_BITS;
+constexpr size_t MAP_MID_BITS = 14;
+constexpr size_t MAP_TOP_BITS = MAP_ADDRESS_BITS - MAP_PAGE_BITS - MAP_LEAF_BITS - MAP_MID_BITS;
+constexpr uintptr_t MAP_PAGES = (uintptr_t)1 << (MAP_ADDRESS_BITS - MAP_PAGE_BITS);
+constexpr uintptr_t MAP_LEAF_TAG = 1;
+constexpr uintptr_t MAP_REGION_MARK = 2;
+constexpr uintptr_t MAP_OWNER_MASK = ~(((uintptr_t)1 << MAP_PAGE_BITS) - 1);
+
+inline MapEntry *mapTables(size_t count) {
+	void *mem = mmap(0, count * sizeof(MapEntry), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return (mem != MAP_FAILED) ? static_cast<MapEntry*>(mem) : nullptr;
+}
+
+inline MapEntry *mapTop() {
+	static MapEntry *top = mapTables((size_t)1 << MAP_TOP_BITS);
+	return top;
+}
+
+// installs a fresh table into an empty entry, or one that holds the value
+// to fill it with. Returns the entry's table
+inline MapEntry *mapInstall(MapEntry &entry, uintptr_t curr, size_t count, uintptr_t tag) {
+	MapEntry *table = mapTables(count);
+	if (table == nullptr)
+		return nullptr;
+	for (size_t i = 0; curr != 0 && i < count; i++)
+		table[i].store(curr, std::memory_order_relaxed);
+
+	if (entry.compare_exchange_strong(curr, (uintptr_t)table | tag,
+			std::memory_order_acq_rel, std::memory_order_acquire))
+		return table;
+
+	munmap(table, count * sizeof(MapEntry));
+	return reinterpret_cast<MapEntry*>(curr & ~tag);
+}
+
+// entry of the given granule, or nullptr if its mid table is missing
+inline MapEntry *mapGranule(uintptr_t granule, bool create) {
+	MapEntry *top = mapTop();
+	if (top == nullptr)
+		return nullptr;
+
+	MapEntry &top_entry = top[granule >> MAP_MID_BITS];
+	MapEntry *mid = reinterpret_cast<MapEntry*>(top_entry.load(std::memory_order_acquire));
+	if (mid == nullptr) {
+		if (!create)
+			return nullptr;
+		mid = mapInstall(top_entry, 0, (size_t)1 << MAP_MID_BITS, 0);
+		if (mid == nullptr)
+			return nullptr;
+	}
+	return &mid[granule & (((uintptr_t)1 << MAP_MID_BITS) - 1)];
+}
+
+// returns false if a table could not be mapped, leaving pages unset
+bool mapSet(void *p, size_t sz, uintptr_t value) {
+	static constexpr uintptr_t LEAF_ENTRIES = (uintptr_t)1 << MAP_LEAF_BITS;
+
+	uintptr_t page = (uintptr_t)p >> MAP_PAGE_BITS;
+	const uintptr_t end = std::min(((uintptr_t)p + sz + ((uintptr_t)1 << MAP_PAGE_BITS) - 1)
+		>> MAP_PAGE_BITS, MAP_PAGES);
+
+	bool result = true;
+	while (page < end) {
+		const uintptr_t granule = page >> MAP_LEAF_BITS;
+		const uintptr_t first = granule << MAP_LEAF_BITS;
+		const uintptr_t last = std::min(end, first + LEAF_ENTRIES);
+
+		MapEntry *entry = mapGranule(granule, value != 0);
+		if (entry != nullptr) {
+			uintptr_t curr = entry->load(std::memory_order_acquire);
+			if (page == first && last == first + LEAF_ENTRIES && !(curr & MAP_LEAF_TAG)) {
+				entry->store(value, std::memory_order_release);
+			} else {
+				MapEntry *leaf = (curr & MAP_LEAF_TAG)
+					? reinterpret_cast<MapEntry*>(curr & ~MAP_LEAF_TAG)
+					: mapInstall(*entry, curr, LEAF_ENTRIES, MAP_LEAF_TAG);
+				for (uintptr_t i = page; leaf != nullptr && i < last; i++)
+					leaf[i - first].store(value, std::memory_order_release);
+				result = result && (leaf != nullptr || value == 0);
+			}
+		} else {
+			result = result && value == 0;
+		}
+		page = last;
+	}
+	return result;
+}
+
+// entry that holds the given page
+inline uintptr_t mapGet(uintptr_t page) {
+	if (page >= MAP_PAGES)
+		return 0;
+
+	const MapEntry *entry = mapGranule(page >> MAP_LEAF_BITS, false);
+	if (entry == nullptr)
+		return 0;
+
+	uintptr_t value = entry->load(std::memory_order_acquire);
+	if (value & MAP_LEAF_TAG) {
+		const MapEntry *leaf = reinterpret_cast<const MapEntry*>(value & ~MAP_LEAF_TAG);
+		value = leaf[page & (((uintptr_t)1 << MAP_LEAF_BITS) - 1)].load(std::memory_order_acquire);
+	}
+	return value;
+}
+
+inline void *mapDecode(uintptr_t value, int *node) {
+	if (node != nullptr)
+		*node = (int)((value & ~MAP_OWNER_MASK) >> 2) - 1;
+	return reinterpret_cast<void*>(value & MAP_OWNER_MASK);
+}
+
+}
+
+/**
+ * Record the page range of p..p+sz as owned by owner, on the given node
+ */
+extern "C" void registerMemory(void *p, size_t sz, void *owner, int node) {
+	assert(((uintptr_t)owner & ~MAP_OWNER_MASK) == 0);
+	assert(node >= -1 && (uintptr_t)(node + 1) << 2 <= ~MAP_OWNER_MASK);
+	mapSet(p, sz, (uintptr_t)owner | ((uintptr_t)(node + 1) << 2));
+}
+
+/**
+ * Like registerMemory, and mark the pages as region memory. Returns 0, or -1
+ * if the address map is out of memory
+ */
+extern "C" int registerRegionMemory(void *p, size_t sz, void *owner, int node) {
+	assert(((uintptr_t)owner & ~MAP_OWNER_MASK) == 0);
+	assert(node >= -1 && (uintptr_t)(node + 1) << 2 <= ~MAP_OWNER_MASK);
+	return mapSet(p, sz, (uintptr_t)owner | ((uintptr_t)(node + 1) << 2) | MAP_REGION_MARK) ? 0 : -1;
+}
+
+/**
+ * Forget the page range of p..p+sz
+ */
+extern "C" void unregisterMemory(void *p, size_t sz) {
+	mapSet(p, sz, 0);
+}
+
+/**
+ * Owner and node of the range that contains p
+ */
+extern "C" void *lookupMemory(const void *p, int *node) {
+	return mapDecode(mapGet((uintptr_t)p >> MAP_PAGE_BITS), node);
+}
+
+/**
+ * Whether p lies in pages marked as region memory
+ */
+extern "C" int isRegionMemory(const void *p) {
+	return (mapGet((uintptr_t)p >> MAP_PAGE_BITS) & MAP_REGION_MARK) != 0;
+}
+
+/**
+ * Like lookupMemory, for count pointers at once. Pointers into the same
+ * granule as their predecessor skip the table walk
+ */
+extern "C" void lookupMemory_n(size_t count, const void **ptrs, void **owners, int *nodes) {
+	uintptr_t last_granule = (uintptr_t)-1;
+	const MapEntry *last_leaf = nullptr;
+	uintptr_t last_value = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		const uintptr_t page = (uintptr_t)ptrs[i] >> MAP_PAGE_BITS;
+		uintptr_t value;
+		if ((page >> MAP_LEAF_BITS) != last_granule) {
+			last_granule = page >> MAP_LEAF_BITS;
+			const MapEntry *entry = (page < MAP_PAGES) ? mapGranule(last_granule, false) : nullptr;
+			last_value = (entry != nullptr) ? entry->load(std::memory_order_acquire) : 0;
+			last_leaf = (last_value & MAP_LEAF_TAG)
+				? reinterpret_cast<const MapEntry*>(last_value & ~MAP_LEAF_TAG) : nullptr;
+		}
+		value = (last_leaf != nullptr)
+			? last_leaf[page & (((uintptr_t)1 << MAP_LEAF_BITS) - 1)].load(std::memory_order_acquire)
+			: last_value;
+
+		void *owner = mapDecode(value, (nodes != nullptr) ? &nodes[i] : nullptr);
+		if (owners != nullptr)
+			owners[i] = owner;
+	}
+}
+
 /**
  * Get page for given pointer
  */
@@ -107,12 +412,44 @@ extern "C" int moveMemory(void *p, size_t sz, int node) {
  * Touches every page from given memory region, to make it page-fault into working set
  */
 void touchMemory(void *p, size_t sz) {
-	for (size_t ofs = 0; ofs < sz; ofs += 4096) {
+	touchMemoryPages(p, sz, 4096);
+}
+
+/**
+ * Touches one word per page of the given size, to make the region page-fault into working set
+ */
+void touchMemoryPages(void *p, size_t sz, size_t page_size) {
+	for (size_t ofs = 0; ofs < sz; ofs += page_size) {
 		size_t *ptr = (size_t*) ((char*)p + ofs);
 		*((size_t volatile *) ptr) = *ptr;
 	}
 }
 
+/**
+ * Fault in the pages of the given region for writing, without changing their
+ * contents. The kernel populates the whole range in one call, where supported
+ */
+void populateMemory(void *p, size_t sz, size_t page_size) {
+	static std::atomic_bool unsupported(false);
+
+	const uintptr_t start = (uintptr_t)p & ~(uintptr_t)4095;
+	if (!unsupported.load(std::memory_order_relaxed)) {
+		if (madvise((void*) start, (uintptr_t)p + sz - start, MADV_POPULATE_WRITE) == 0)
+			return;
+		if (errno != EINVAL)
+			return;
+		unsupported.store(true, std::memory_order_relaxed);
+	}
+
+	// the region may be in use, so its words must not be read and written
+	// back. A locked add of zero faults a page in for writing, and leaves
+	// concurrent stores intact. Huge page mappings may have fallen back to
+	// base pages, each of those is touched
+	(void) page_size;
+	for (uintptr_t page = start; page < (uintptr_t)p + sz; page += 4096)
+		__atomic_fetch_add((size_t*) page, 0, __ATOMIC_RELAXED);
+}
+
 namespace numa {
 namespace util {
 
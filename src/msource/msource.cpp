@@ -2,8 +2,11 @@
 #include <atomic>
 #include <cstdio>
 #include <cstddef>
+#include <cstdint>
 #include <cassert>
+#include <cerrno>
 #include <cstring>
+#include <functional>
 #include <mutex>
 #include <vector>
 
@@ -17,15 +20,115 @@
 #include "PGASUS/msource/mmaphelper.h"
 #include "base/debug.hpp"
 #include "msource/malloc-numa.h"
+#include "msource/msource_trace.hpp"
 
-#if MEM_SOURCE_USE_PTHREAD_SPINLOCK
 #include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#ifndef MEM_SOURCE_THREAD_CACHE
+#define MEM_SOURCE_THREAD_CACHE 1
 #endif
 
 
 namespace numa {
 namespace msource {
 
+/**
+ * Hands out small, process-wide unique indices to threads, so that per-thread
+ * data can be stored in plain arrays. Slots of terminated threads are
+ * recycled, along with the data stored under that index.
+ */
+class ThreadSlots
+{
+public:
+	static constexpr size_t COUNT = 256;
+
+private:
+	static constexpr size_t WORD_BITS = 8 * sizeof(uint64_t);
+	static constexpr int NONE = -1;      // no slot acquired yet
+	static constexpr int EXPIRED = -2;   // thread is terminating, don't acquire again
+
+	static std::atomic<uint64_t> s_used[COUNT / WORD_BITS];
+	static pthread_key_t s_key;
+	static pthread_once_t s_key_once;
+	static thread_local int s_slot __attribute__((tls_model("initial-exec")));
+
+	static void create_key() {
+		pthread_key_create(&s_key, release);
+	}
+
+	static void release(void *data) {
+		const size_t slot = (size_t)data - 1;
+		s_slot = EXPIRED;
+		s_used[slot / WORD_BITS].fetch_and(~((uint64_t)1 << (slot % WORD_BITS)),
+			std::memory_order_release);
+	}
+
+	static int acquire() {
+		if (s_slot == EXPIRED)
+			return -1;
+
+		for (size_t w = 0; w < COUNT / WORD_BITS; w++) {
+			uint64_t used = s_used[w].load(std::memory_order_relaxed);
+			while (~used != 0) {
+				const size_t bit = __builtin_ctzll(~used);
+				const uint64_t mask = (uint64_t)1 << bit;
+				used = s_used[w].fetch_or(mask, std::memory_order_acquire);
+				if ((used & mask) == 0) {
+					// setspecific may allocate, so publish the slot first
+					s_slot = (int)(w * WORD_BITS + bit);
+					pthread_once(&s_key_once, create_key);
+					pthread_setspecific(s_key, (void*)(size_t)(s_slot + 1));
+					return s_slot;
+				}
+			}
+		}
+
+		// all slots taken, don't try again for this thread
+		s_slot = EXPIRED;
+		return -1;
+	}
+
+public:
+	/**
+	 * Slot of the calling thread, or -1 if none is available
+	 */
+	static inline int current() {
+		const int slot = s_slot;
+		return (slot >= 0) ? slot : acquire();
+	}
+};
+
+std::atomic<uint64_t> ThreadSlots::s_used[ThreadSlots::COUNT / ThreadSlots::WORD_BITS];
+pthread_key_t ThreadSlots::s_key;
+pthread_once_t ThreadSlots::s_key_once = PTHREAD_ONCE_INIT;
+thread_local int ThreadSlots::s_slot __attribute__((tls_model("initial-exec"))) = ThreadSlots::NONE;
+
+/**
+ * NUMA node the calling thread runs on, or -1 if unknown. The value is cached
+ * and only refreshed every few calls, as threads that care about placement
+ * are pinned anyway.
+ */
+static inline int curr_thread_node() {
+	static constexpr unsigned REFRESH_INTERVAL = 4096;
+	static thread_local int node __attribute__((tls_model("initial-exec"))) = -1;
+	static thread_local unsigned calls __attribute__((tls_model("initial-exec"))) = 0;
+
+	if (calls++ % REFRESH_INTERVAL == 0) {
+		unsigned cpu, n;
+		node = (syscall(SYS_getcpu, &cpu, &n, nullptr) == 0) ? (int)n : -1;
+	}
+	return node;
+}
+
+// set once the first region msource with chunks is destroyed, see
+// MemSourceImpl::free()
+static std::atomic_bool s_regions_destroyed(false);
+
 class MemSourceImpl
 {
 private:
@@ -34,12 +137,14 @@ private:
 	typedef pthread_spinlock_t SpinLock;
 	#define SpinLock_lock(s) pthread_spin_lock(&s)
 	#define SpinLock_unlock(s) pthread_spin_unlock(&s)
+	#define SpinLock_trylock(s) (pthread_spin_trylock(&s) == 0)
 	#define SpinLock_init(s) (pthread_spin_init(&s, PTHREAD_PROCESS_PRIVATE) == 0)
 	#define SpinLock_destroy(s) (pthread_spin_destroy(&s) == 0)
 #else
 	typedef numa::SpinLockType<LinearBackOff<256,4096>> SpinLock;
 	#define SpinLock_lock(s) s.lock()
 	#define SpinLock_unlock(s) s.unlock()
+	#define SpinLock_trylock(s) s.try_lock()
 	#define SpinLock_init(s) (true)
 	#define SpinLock_destroy(s) (true)
 #endif
@@ -78,10 +183,31 @@ private:
 		MemSourceImpl  *source;
 
 		union {
-			Arena       *arena; // NULL if allocated with mmap
-			ChunkFooter *link;  // if source==NULL, this points to actual footer
+			uintptr_t    arena_tag; // Arena (NULL if allocated with mmap), or'ed with
+			                        // the size class + 1 of chunks in thread caches
+			ChunkFooter *link;      // if source==NULL, this points to actual footer
 		};
 
+		// arenas are aligned to 64 bytes, which leaves the low bits for the tag
+		static constexpr uintptr_t TAG_MASK = 63;
+
+		inline Arena *arena() const {
+			return reinterpret_cast<Arena*>(arena_tag & ~TAG_MASK);
+		}
+
+		inline void set_arena(Arena *a) {
+			arena_tag = reinterpret_cast<uintptr_t>(a);
+		}
+
+		// size class the chunk has been cached in, -1 if never
+		inline int cache_class() const {
+			return (int)(arena_tag & TAG_MASK) - 1;
+		}
+
+		inline void set_cache_class(size_t cls) {
+			arena_tag = (arena_tag & ~TAG_MASK) | (uintptr_t)(cls + 1);
+		}
+
 		static constexpr inline intptr_t DATA_OFFSET() {
 			return ALIGN_UP(sizeof(ChunkFooter), 2*sizeof(intptr_t));
 		}
@@ -100,6 +226,13 @@ private:
 	struct MmapChunkFooter
 	{
 		size_t size;
+		int node;    // where the chunk has been placed, -1 if not on a single node
+
+		// chunks being worked on without mmapped_chunk_lock are pinned. A pinned
+		// chunk that is freed stays listed until its last pin is dropped.
+		// Both are protected by mmapped_chunk_lock
+		uint16_t pins;
+		bool freed;
 
 		// Double-linked list of all mmapped-chunks within one msource
 		MmapChunkFooter *prev;
@@ -113,6 +246,8 @@ private:
 				offsetof(MmapChunkFooter, footer)
 					+ sizeof(ChunkFooter)
 					== sizeof(MmapChunkFooter), "Footer alignment wrong");
+			static_assert(sizeof(MmapChunkFooter) % (2*sizeof(intptr_t)) == 0,
+				"Chunk data alignment wrong");
 			return sizeof(MmapChunkFooter);
 		}
 
@@ -131,8 +266,14 @@ private:
 		MemSourceImpl              *msource;
 
 		size_t                  size;      // total space in mspace
-		size_t                  alloc_end; // no allocated bytes behind this offset
+		size_t                  length;    // bytes mapped for the arena, incl. header
+		size_t                  alloc_end; // no allocated bytes behind this offset from base
+		size_t                  zero_from; // memory behind this offset is untouched (zero)
+		std::atomic_size_t      in_use;    // bytes in allocated chunks (incl. cached)
+		size_t                  freed;     // bytes freed since the last trim
+		size_t                  released;  // total bytes returned to the OS
 		bool                    native;    // mspace is directly behind arena data?
+		uint64_t                created;   // when it was added, in ns. 0 once it advanced the growth
 
 		void                   *base;      // start of msp
 		mspace                  msp;
@@ -143,38 +284,57 @@ private:
 		Arena                  *prev;
 		Arena                  *next;
 
-		// if dst_node >= 0: directly allocate on node. If < 0, use adjacent mem
-		Arena(MemSourceImpl *ms, size_t sz, int dst_node = -1) {
+		// Chunks freed by threads on other nodes, linked through their
+		// footers. Kept on its own cache line, away from mspace_lock.
+		alignas(64) std::atomic<ChunkFooter*> remote_frees;
+
+		// if separate: map the mspace on its own, placed like the msource's
+		// data. Otherwise, use adjacent mem. If that mapping fails, msp is
+		// left null and the arena must be destroyed again
+		Arena(MemSourceImpl *ms, size_t sz, bool separate = false) {
 			msource = ms;
-			alloc_end = MEM_PAGE_SIZE;
+			length = sz;
+			alloc_end = 0;
+			in_use = 0;
+			freed = 0;
+			released = 0;
+			created = 0;
 			prev = nullptr;
 			next = nullptr;
+			remote_frees = nullptr;
 			if (!SpinLock_init(mspace_lock)) {
                 assert(false);
             }
 
 			// create mspace
-			if (dst_node < 0) {
+			if (!separate) {
 				base = (void*) ALIGN_UP((intptr_t)this + sizeof(*this), 64);
 				size = ((intptr_t)this + sz) - (intptr_t)base;
 				native = true;
 			} else {
-				base = callMmap(sz, dst_node);
-				size = sz;
+				size = ALIGN_UP(sz, ms->page_size);
+				base = ms->map_data(size);
 				native = false;
 			}
 
-			msp = create_mspace_with_base(base, size, 0);
+			msp = nullptr;
+			zero_from = 0;
+			if (base != nullptr) {
+				msp = create_mspace_with_base(base, size, 0);
+				update_zero_from();
+			}
 
 			prev = nullptr;
 			next = nullptr;
 		}
 
 		~Arena() {
-			destroy_mspace(msp);
+			if (msp != nullptr) {
+				destroy_mspace(msp);
+			}
 
-			if (!native) {
-				munmap(base, size);
+			if (!native && base != nullptr) {
+				unmap(base, size);
 			}
 
 			if (!SpinLock_destroy(mspace_lock)) {
@@ -182,28 +342,196 @@ private:
             }
 		}
 
-		inline ChunkFooter *alloc(size_t sz) {
-			SpinLock_lock(mspace_lock);
+		// expects mspace_lock to be held. Whatever the mspace has written so
+		// far ends with the header of its top chunk, the chunks' data lies
+		// below that
+		inline void update_zero_from() {
+			void *top_chunk;
+			size_t top_chunk_size;
+			mspace_get_top_chunk_extent(msp, &top_chunk, &top_chunk_size);
+			const size_t top_end = (intptr_t)top_chunk - (intptr_t)base + 2 * sizeof(size_t);
+			if (zero_from < top_end) {
+				zero_from = top_end;
+			}
+		}
 
+		// expects mspace_lock to be held. If given, sets zeroed to whether
+		// the chunk's data is known to be zero
+		inline ChunkFooter *alloc_locked(size_t sz, bool *zeroed = nullptr) {
 			size_t alloc_size = sz + ChunkFooter::DATA_OFFSET();
 
 			ChunkFooter *chunk = static_cast<ChunkFooter*>(mspace_malloc(msp, alloc_size));
 
 			if (chunk != nullptr) {
 				// update alloc end ptr
-				const size_t rel_chunk_start = (intptr_t)chunk - (intptr_t)this;
-				const size_t current_end = rel_chunk_start + sz;
+				const size_t rel_chunk_start = (intptr_t)chunk - (intptr_t)base;
+				const size_t current_end = rel_chunk_start + alloc_size;
 				if (alloc_end < current_end) {
 					alloc_end = current_end;
 				}
 
+				// taken from the untouched part of the top chunk?
+				if (zeroed != nullptr)
+					*zeroed = rel_chunk_start + ChunkFooter::DATA_OFFSET() >= zero_from;
+				update_zero_from();
+
 				chunk->source = msource;
-				chunk->arena = this;
+				chunk->set_arena(this);
+
+				// only modified under mspace_lock, so no atomic RMW needed
+				in_use.store(in_use.load(std::memory_order_relaxed)
+					+ dlmalloc_usable_size((void*) chunk), std::memory_order_relaxed);
 			}
 
+			return chunk;
+		}
+
+		// grow or shrink an allocated chunk without moving it. Returns the
+		// change of its usable size, or false if it could not be resized
+		inline bool resize(ChunkFooter *ch, size_t sz, ssize_t &delta) {
+			const size_t alloc_size = sz + ChunkFooter::DATA_OFFSET();
+
+			SpinLock_lock(mspace_lock);
+			const size_t old_usable = dlmalloc_usable_size((void*) ch);
+			const bool ok = mspace_realloc_in_place(msp, (void*) ch, alloc_size) != nullptr;
+			if (ok) {
+				const size_t usable = dlmalloc_usable_size((void*) ch);
+				const size_t current_end = (intptr_t)ch - (intptr_t)base + alloc_size;
+				if (alloc_end < current_end) {
+					alloc_end = current_end;
+				}
+				update_zero_from();
+
+				in_use.store(in_use.load(std::memory_order_relaxed) + usable - old_usable,
+					std::memory_order_relaxed);
+				if (usable < old_usable)
+					freed += old_usable - usable;
+				delta = (ssize_t)usable - (ssize_t)old_usable;
+			}
 			SpinLock_unlock(mspace_lock);
 
-			return chunk;
+			return ok;
+		}
+
+		// expects mspace_lock to be held
+		inline void free_locked(ChunkFooter *ch) {
+			const size_t usable = dlmalloc_usable_size((void*) ch);
+			in_use.store(in_use.load(std::memory_order_relaxed) - usable,
+				std::memory_order_relaxed);
+			msource->footprint.fetch_sub(usable, std::memory_order_relaxed);
+			mspace_free(msp, (void*) ch);
+
+			// trim after enough frees, or once a large arena runs empty
+			freed += usable;
+			if (PGASUS_TRIM_THRESHOLD > 0 && (freed >= PGASUS_TRIM_THRESHOLD
+					|| (in_use.load(std::memory_order_relaxed) == 0
+						&& alloc_end >= PGASUS_TRIM_THRESHOLD)))
+				trim_locked();
+		}
+
+		// end of the range that may contain touched pages
+		inline intptr_t dirty_end() const {
+			return (intptr_t)base + (intptr_t)std::min(alloc_end, size);
+		}
+
+		// expects mspace_lock to be held. Returns unused memory to the OS: all
+		// of it, if no chunk is allocated, otherwise the top chunk. Returns the
+		// number of bytes released
+		size_t trim_locked() {
+			intptr_t start, end;
+			freed = 0;
+
+			// dirty pages end with the last touched byte. Untouched pages up
+			// to there are released as well, so that the arena is known to be
+			// zero behind the released range again
+			const intptr_t touched_end = ALIGN_UP(std::max(dirty_end(),
+				(intptr_t)base + (intptr_t)zero_from), msource->page_size);
+
+			if (in_use.load(std::memory_order_relaxed) == 0) {
+				// nothing allocated since the last start over
+				if (alloc_end == 0)
+					return 0;
+
+				// start over with a fresh mspace, the old one is dropped entirely
+				destroy_mspace(msp);
+				start = ALIGN_UP((intptr_t)base, msource->page_size);
+				end = std::min(touched_end, ALIGN_DOWN((intptr_t)base + (intptr_t)size,
+					msource->page_size));
+				if (end > start)
+					madvise((void*) start, end - start, MADV_DONTNEED);
+				msp = create_mspace_with_base(base, size, 0);
+				alloc_end = 0;
+				if (end >= (intptr_t)base + (intptr_t)zero_from)
+					zero_from = start - (intptr_t)base;
+				update_zero_from();
+			} else {
+				// keep the top chunk's header and the segment footer behind it
+				void *top_chunk;
+				size_t top_chunk_size;
+				mspace_get_top_chunk_extent(msp, &top_chunk, &top_chunk_size);
+				start = ALIGN_UP((intptr_t) top_chunk + 64, msource->page_size);
+				end = std::min(touched_end, ALIGN_DOWN((intptr_t) top_chunk
+					+ (intptr_t) top_chunk_size - 64, msource->page_size));
+				if (end > start) {
+					madvise((void*) start, end - start, MADV_DONTNEED);
+					alloc_end = start - (intptr_t)base;
+					if (end >= (intptr_t)base + (intptr_t)zero_from)
+						zero_from = start - (intptr_t)base;
+				}
+			}
+
+			if (end <= start)
+				return 0;
+
+			released += end - start;
+			return end - start;
+		}
+
+		inline size_t trim() {
+			SpinLock_lock(mspace_lock);
+			drain_remote_locked();
+			size_t result = trim_locked();
+			SpinLock_unlock(mspace_lock);
+			return result;
+		}
+
+		// approximate number of bytes that are still available in the arena
+		inline size_t free_space() const {
+			const size_t used = in_use.load(std::memory_order_relaxed);
+			return (used < size) ? size - used : 0;
+		}
+
+		// allocate up to n chunks of sz bytes at once. returns number of chunks.
+		// zeroed is set for the last one
+		inline size_t alloc_batch(size_t sz, ChunkFooter **chunks, size_t n,
+				bool *zeroed = nullptr) {
+			size_t count = 0;
+			SpinLock_lock(mspace_lock);
+			drain_remote_locked();
+			const size_t used = in_use.load(std::memory_order_relaxed);
+			while (count < n && (chunks[count] = alloc_locked(sz, zeroed)) != nullptr)
+				count++;
+			msource->grow_footprint(in_use.load(std::memory_order_relaxed) - used);
+			SpinLock_unlock(mspace_lock);
+			return count;
+		}
+
+		// like alloc_batch, but gives up if the arena is locked by another
+		// thread. sets contended in that case
+		inline size_t try_alloc_batch(size_t sz, ChunkFooter **chunks, size_t n, bool &contended,
+				bool *zeroed = nullptr) {
+			if (!SpinLock_trylock(mspace_lock)) {
+				contended = true;
+				return 0;
+			}
+			size_t count = 0;
+			drain_remote_locked();
+			const size_t used = in_use.load(std::memory_order_relaxed);
+			while (count < n && (chunks[count] = alloc_locked(sz, zeroed)) != nullptr)
+				count++;
+			msource->grow_footprint(in_use.load(std::memory_order_relaxed) - used);
+			SpinLock_unlock(mspace_lock);
+			return count;
 		}
 
 		inline void free(void *p, ChunkFooter *ch) {
@@ -212,51 +540,386 @@ private:
 			size_t clearSize = (uintptr_t)p - (uintptr_t)ch;
 			memset((void*) ch, 0xCC, clearSize);
 		#endif
-			mspace_free(msp, (void*) ch);
+			drain_remote_locked();
+			free_locked(ch);
 			SpinLock_unlock(mspace_lock);
 		}
 
-		size_t prefault(size_t bytes) {
-			size_t max = std::min(bytes, size);
-			touchMemory((void*) base, max);
-			return max;
+		// lock-free push of a chunk that was freed on another node. It is
+		// returned to the mspace by the next allocation from or free to this
+		// arena on its node, or once no stripe uses the arena anymore.
+		inline void free_remote(ChunkFooter *ch) {
+			ChunkFooter *head = remote_frees.load(std::memory_order_relaxed);
+			do {
+				ch->link = head;
+			} while (!remote_frees.compare_exchange_weak(head, ch,
+				std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		// expects mspace_lock to be held
+		inline void drain_remote_locked() {
+			if (remote_frees.load(std::memory_order_relaxed) == nullptr)
+				return;
+
+			ChunkFooter *ch = remote_frees.exchange(nullptr, std::memory_order_acquire);
+			while (ch != nullptr) {
+				ChunkFooter *next = ch->link;
+				free_locked(ch);
+				ch = next;
+			}
+		}
+
+		// returns remotely freed chunks, unless the arena is busy anyway
+		inline void try_drain_remote() {
+			if (remote_frees.load(std::memory_order_relaxed) == nullptr
+					|| !SpinLock_trylock(mspace_lock))
+				return;
+			drain_remote_locked();
+			SpinLock_unlock(mspace_lock);
 		}
 	};
 
-	// stores in one atomic word:
-	//  - number of allocated blocks
-	//  - number of references
-	// if this counter reaches zero, the source can be destroyed.
+	// allocation counters of one thread, or the shared ones of threads
+	// without a cache. Readers sum all of them up, without locking
+	struct AllocCounters
+	{
+		std::atomic_size_t      allocs;
+		std::atomic_size_t      frees;
+		std::atomic_size_t      remote_frees;
+		std::atomic_size_t      alloc_bytes;
+		std::atomic_size_t      free_bytes;
+		std::atomic_size_t      size_classes[MSOURCE_SIZE_CLASSES];
+
+		AllocCounters() : allocs(0), frees(0), remote_frees(0), alloc_bytes(0), free_bytes(0) {
+			for (std::atomic_size_t &c : size_classes)
+				c = 0;
+		}
+
+		// counters with a single writer need no atomic read-modify-write
+		static inline void add(std::atomic_size_t &c, size_t v, bool shared) {
+			if (shared)
+				c.fetch_add(v, std::memory_order_relaxed);
+			else
+				c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+		}
+
+		static inline size_t size_class(size_t requested) {
+			if (requested <= 16)
+				return 0;
+			const size_t cls = 64 - __builtin_clzll((unsigned long long)requested - 1) - 4;
+			return std::min(cls, MSOURCE_SIZE_CLASSES - 1);
+		}
+
+		inline void count_alloc(size_t requested, size_t usable, bool shared) {
+			add(allocs, 1, shared);
+			add(alloc_bytes, usable, shared);
+			add(size_classes[size_class(requested)], 1, shared);
+		}
+
+		inline void count_resize(ssize_t delta, bool shared) {
+			if (delta > 0)
+				add(alloc_bytes, (size_t)delta, shared);
+			else
+				add(free_bytes, (size_t)-delta, shared);
+		}
+
+		inline void count_free(size_t usable, bool remote, bool shared) {
+			add(frees, 1, shared);
+			add(free_bytes, usable, shared);
+			if (remote)
+				add(remote_frees, 1, shared);
+		}
+
+		void add_to(struct msource_info &info) const {
+			info.alloc_count += allocs.load(std::memory_order_relaxed);
+			info.free_count += frees.load(std::memory_order_relaxed);
+			info.remote_free_count += remote_frees.load(std::memory_order_relaxed);
+			// only the sum over all threads is meaningful
+			info.live_bytes += alloc_bytes.load(std::memory_order_relaxed)
+				- free_bytes.load(std::memory_order_relaxed);
+			for (size_t i = 0; i < MSOURCE_SIZE_CLASSES; i++)
+				info.alloc_size_classes[i] += size_classes[i].load(std::memory_order_relaxed);
+		}
+	};
+
+	// Small blocks carry no footer: they are slots of equally sized blocks
+	// within spans, which are carved from segments aligned to their size. A
+	// block's segment header, and thus its msource, is found by masking its
+	// address. A global bitmap tells which addresses lie in segments.
+	struct SlabSegment
+	{
+		static constexpr size_t SIZE = (size_t)2 << 20;
+		static constexpr size_t SPAN_SIZE = (size_t)16 << 10;
+		static constexpr size_t SPAN_COUNT = SIZE / SPAN_SIZE;   // span 0 holds the header
+		static constexpr size_t CLASS_SIZE = 16;
+		static constexpr size_t CLASS_COUNT = 16;
+		static constexpr size_t MAX_SIZE = CLASS_SIZE * CLASS_COUNT;
+		static constexpr uint16_t NO_CLASS = 0xffff;
+
+		struct Span {
+			void               *free;       // freed slots, linked through their first word
+			uint32_t            used;       // slots handed out, incl. those in thread caches
+			uint32_t            carved;     // slots handed out before, the rest is untouched
+			uint16_t            cls;        // NO_CLASS, if the span is unused
+			bool                released;   // unused span, whose pages went back to the OS
+			Span               *prev;       // in the msource's partial or unused span list
+			Span               *next;
+		};
+
+		MemSourceImpl          *source;
+		SlabSegment            *next;       // in the msource's segment list
+		Span                    spans[SPAN_COUNT];
+
+		SlabSegment(MemSourceImpl *src, SlabSegment *n) : source(src), next(n) {
+			memset(spans, 0, sizeof(spans));
+			// untouched spans have no pages to release
+			for (Span &span : spans) {
+				span.cls = NO_CLASS;
+				span.released = true;
+			}
+		}
+
+		static inline size_t class_of_request(size_t sz) {
+			return (sz > 0) ? (sz - 1) / CLASS_SIZE : 0;
+		}
+
+		static inline size_t class_size(size_t cls) {
+			return (cls + 1) * CLASS_SIZE;
+		}
+
+		static inline size_t class_slots(size_t cls) {
+			return SPAN_SIZE / class_size(cls);
+		}
+
+		inline char *span_data(const Span *span) {
+			return (char*)this + (span - spans) * SPAN_SIZE;
+		}
+
+		inline Span *span_of(const void *p) {
+			return &spans[((uintptr_t)p - (uintptr_t)this) / SPAN_SIZE];
+		}
+
+		// one bit per segment-sized range of the address space. The map is
+		// reserved once, only its touched words get backed by memory. If it
+		// can't be reserved, there are no segments and all blocks have footers
+		static constexpr size_t ADDRESS_BITS = 48;
+		static constexpr size_t MAP_BITS = (size_t)1 << (ADDRESS_BITS - 21);
+		static_assert(SIZE == (size_t)1 << 21, "Segment size does not match map");
+
+		static std::atomic<uint64_t> *reserve_map() {
+			void *mem = mmap(0, MAP_BITS / 8, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			return (mem != MAP_FAILED) ? static_cast<std::atomic<uint64_t>*>(mem) : nullptr;
+		}
+
+		// null if the map is not available
+		static inline std::atomic<uint64_t> *map() {
+			static std::atomic<uint64_t> *bits = reserve_map();
+			return bits;
+		}
+
+		static inline void set_mapped(SlabSegment *seg, bool mapped) {
+			const size_t idx = (uintptr_t)seg / SIZE;
+			if (mapped)
+				map()[idx / 64].fetch_or((uint64_t)1 << (idx % 64), std::memory_order_release);
+			else
+				map()[idx / 64].fetch_and(~((uint64_t)1 << (idx % 64)), std::memory_order_release);
+		}
+
+		// segment that holds the given block, or nullptr for blocks with footer
+		static inline SlabSegment *of(const void *p) {
+			const size_t idx = (uintptr_t)p / SIZE;
+			std::atomic<uint64_t> *bits = map();
+			if (idx >= MAP_BITS || bits == nullptr)
+				return nullptr;
+			if (!((bits[idx / 64].load(std::memory_order_relaxed) >> (idx % 64)) & 1))
+				return nullptr;
+			return reinterpret_cast<SlabSegment*>((uintptr_t)p & ~(SIZE - 1));
+		}
+	};
+
+	static_assert(sizeof(SlabSegment) <= SlabSegment::SPAN_SIZE, "Segment header exceeds its span");
+
+	// mapping of a region msource, from which blocks are bumped. Each block
+	// has a footer whose tag holds the block's size. Chunks stay mapped until
+	// the msource is destroyed
+	struct RegionChunk
+	{
+		RegionChunk            *next;       // in the order the chunks are used
+		size_t                  size;       // mapped bytes, incl. this header
+		size_t                  high;       // bytes used before, the rest is untouched
+		std::atomic_size_t      top;        // offset of the first unused byte
+
+		static constexpr size_t HEADER_SIZE() {
+			return ALIGN_UP(sizeof(RegionChunk), 16);
+		}
+
+		RegionChunk(size_t sz, RegionChunk *n) : next(n), size(sz), high(0), top(HEADER_SIZE()) {}
+	};
+
+	// per-thread stash of free small chunks, binned by size class. Only the
+	// thread owning the slot accesses it, so no locking is needed. The chunks
+	// stay allocated within their arenas and keep their footers.
+	struct ThreadCache
+	{
+		static constexpr size_t CLASS_SIZE = 16;
+		static constexpr size_t CLASS_COUNT = 32;
+		static constexpr size_t MAX_SIZE = CLASS_SIZE * CLASS_COUNT;
+		static constexpr size_t BATCH = 16;            // chunks per refill/drain
+		static constexpr size_t CAPACITY = 4 * BATCH;  // max. chunks per class
+
+		// smaller chunks are served by slab segments
+		static constexpr size_t FIRST_CLASS = SlabSegment::MAX_SIZE / CLASS_SIZE;
+
+		static_assert(CLASS_COUNT < ChunkFooter::TAG_MASK, "Size class does not fit into tag");
+
+		struct Bin {
+			ChunkFooter        *head;
+			size_t              count;
+		};
+
+		// free slab slots, linked through their first word
+		struct SlabBin {
+			void               *head;
+			size_t              count;
+		};
+
+		Bin                     bins[CLASS_COUNT];
+		SlabBin                 slabs[SlabSegment::CLASS_COUNT];
+		AllocCounters           counters;  // written by the owning thread only
+		std::atomic<ssize_t>    blocks;    // shard of the msource's BlockCount
+		std::atomic_bool        blocks_busy;
+
+		ThreadCache() : blocks(0), blocks_busy(false) {
+			memset(bins, 0, sizeof(bins));
+			memset(slabs, 0, sizeof(slabs));
+		}
+
+		// class that serves requests of sz bytes
+		static inline size_t class_of_request(size_t sz) {
+			return (sz > 0) ? (sz - 1) / CLASS_SIZE : 0;
+		}
+
+		// class that a chunk with given usable size can serve, or CLASS_COUNT
+		static inline size_t class_of_chunk(size_t usable) {
+			if (usable < CLASS_SIZE || usable >= MAX_SIZE + CLASS_SIZE)
+				return CLASS_COUNT;
+			return usable / CLASS_SIZE - 1;
+		}
+
+		static inline size_t class_size(size_t cls) {
+			return (cls + 1) * CLASS_SIZE;
+		}
+
+		// free chunks are linked through their (unused) data area
+		static inline ChunkFooter *&next(ChunkFooter *ch) {
+			return *static_cast<ChunkFooter**>(ch->TO_POINTER());
+		}
+
+		inline void push(size_t cls, ChunkFooter *ch) {
+			ch->set_cache_class(cls);
+			next(ch) = bins[cls].head;
+			bins[cls].head = ch;
+			bins[cls].count++;
+		}
+
+		inline ChunkFooter *pop(size_t cls) {
+			ChunkFooter *ch = bins[cls].head;
+			if (ch != nullptr) {
+				bins[cls].head = next(ch);
+				bins[cls].count--;
+			}
+			return ch;
+		}
+
+		inline void push_slab(size_t cls, void *p) {
+			*static_cast<void**>(p) = slabs[cls].head;
+			slabs[cls].head = p;
+			slabs[cls].count++;
+		}
+
+		inline void *pop_slab(size_t cls) {
+			void *p = slabs[cls].head;
+			if (p != nullptr) {
+				slabs[cls].head = *static_cast<void**>(p);
+				slabs[cls].count--;
+			}
+			return p;
+		}
+	};
+
+	// counts references and allocated blocks. Once both reach zero, the
+	// source can be destroyed. While the source is referenced, blocks are
+	// counted in per-thread shards (the thread caches), and the central count
+	// carries a bias, so it can't reach zero. Releasing the last reference
+	// moves the shards into the central count and drops the bias. From then
+	// on, the last free() finds the central count at zero. A shard's owner
+	// marks it busy while removing a block, so the source is not destroyed
+	// under its feet.
 	class BlockCount {
 	private:
-		std::atomic_size_t _value;
-		static constexpr size_t BlockBits = 40;
-		static constexpr size_t RefBits = (8*sizeof(size_t)) - BlockBits;
-		static constexpr size_t BlockMask = ((size_t)1 << BlockBits) - 1;
+		static constexpr ssize_t LiveBias = (ssize_t)1 << 62;
 
-		inline bool isLastDeref(size_t delta) {
-			return _value.fetch_sub(delta) == delta;
-		}
+		std::atomic_size_t      _refs;
+		std::atomic<ssize_t>    _blocks;     // blocks counted centrally, plus LiveBias
+		std::atomic_bool        _abandoned;
 
 	public:
-		BlockCount() : _value(0) {}
-		inline size_t blocks() const {
-			return _value.load() & BlockMask;
-		}
+		BlockCount() : _refs(0), _blocks(LiveBias), _abandoned(false) {}
 		inline size_t refs() const {
-			return _value.load() >> BlockBits;
+			return _refs.load(std::memory_order_relaxed);
+		}
+		// central count, without the shards
+		inline ssize_t blocks() const {
+			const ssize_t value = _blocks.load(std::memory_order_relaxed);
+			return _abandoned.load(std::memory_order_relaxed) ? value : value - LiveBias;
 		}
 		inline void ref() {
-			_value.fetch_add((size_t)1 << BlockBits);
+			_refs.fetch_add(1, std::memory_order_relaxed);
 		}
+		// returns true for the last reference
 		inline bool deref() {
-			return isLastDeref((size_t)1 << BlockBits);
+			return _refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
 		}
 		inline void addBlock() {
-			_value.fetch_add(1);
+			_blocks.fetch_add(1, std::memory_order_relaxed);
 		}
 		inline bool removeBlock() {
-			return isLastDeref(1);
+			return _blocks.fetch_sub(1, std::memory_order_acq_rel) == 1;
+		}
+		static inline void addBlock(std::atomic<ssize_t> &shard) {
+			shard.fetch_add(1, std::memory_order_relaxed);
+		}
+		// the shard is moved by its owner once the source is abandoned, the
+		// abandoning thread may miss the decrement otherwise. Until busy is
+		// cleared, the abandoning thread waits before moving the shard, as
+		// that may let the count reach zero
+		inline bool removeBlock(std::atomic<ssize_t> &shard, std::atomic_bool &busy) {
+			busy.store(true, std::memory_order_seq_cst);
+			shard.fetch_sub(1, std::memory_order_relaxed);
+			const bool result = _abandoned.load(std::memory_order_seq_cst) && flush(shard);
+			busy.store(false, std::memory_order_release);
+			return result;
+		}
+		// moves a shard into the central count. returns true, if that
+		// made it reach zero
+		inline bool flush(std::atomic<ssize_t> &shard) {
+			const ssize_t value = shard.exchange(0, std::memory_order_seq_cst);
+			return value != 0 && _blocks.fetch_add(value, std::memory_order_acq_rel) + value == 0;
+		}
+		// moves another thread's shard, once it is not busy
+		inline void flush(std::atomic<ssize_t> &shard, const std::atomic_bool &busy) {
+			while (busy.load(std::memory_order_seq_cst))
+				sched_yield();
+			flush(shard);
+		}
+		// after the last reference is gone: shards must be flushed after
+		// this, then release() drops the bias
+		inline void abandon() {
+			_abandoned.store(true, std::memory_order_seq_cst);
+		}
+		inline bool release() {
+			return _blocks.fetch_sub(LiveBias, std::memory_order_acq_rel) == LiveBias;
 		}
 
 	};
@@ -264,46 +927,135 @@ private:
 	static constexpr size_t     NAME_LENGTH = 128;
 	char                        description[NAME_LENGTH];
 
-	int                         node;             // where the memory comes from
+	// Nodes that the memory of an interleaved msource is spread across. Weights
+	// are normalized, equal weights use the kernel's page interleaving
+	struct Interleave
+	{
+		static constexpr size_t MAX_NODES = 64;
+		static constexpr unsigned MAX_WEIGHT = 16;          // resolution of weights
+		static constexpr size_t GRANULE = (size_t)64 << 10; // run length per weight unit
+
+		size_t                  count;                      // 0: not interleaved
+		int                     nodes[MAX_NODES];
+		unsigned                weights[MAX_NODES];
+
+		inline int apply(void *mem, size_t sz, size_t page_size) const {
+			return interleaveMemory(mem, sz, nodes, weights, count, std::max(page_size, GRANULE));
+		}
+	};
+
+	std::atomic_int             node;             // where the memory comes from, -1 if interleaved.
+	                                              // migrate() changes it, interleave only applies while it is -1
 	int                         node_home;        // where the data structs lie, or -1, if its the same
+	Interleave                  interleave;
 
 	size_t                      mmap_threshold;
 	size_t                      mem_size;
 
-	SpinLock                    arena_lock;
+	PageSize                    page_policy;
+	size_t                      page_size;        // bytes per page, all mappings are aligned to it
+
+	// Threads allocate from one of several arenas, chosen by their thread
+	// slot. Stripes start out sharing an arena and move to another one when
+	// it is exhausted or found locked.
+	static constexpr size_t     ARENA_STRIPES = 8;
+
+	SpinLock                    arena_lock;       // protects arena list and stripe reassignment
 	Arena                      *native_arena;
-	Arena                      *active_arena;
+	Arena                      *arena_list;
+	size_t                      arena_count;
+	std::atomic<Arena*>         stripe_arenas[ARENA_STRIPES];
+
+	// sizes of added arenas, protected by arena_lock
+	msource_growth              growth;
+	size_t                      growth_last;      // bytes of the last arena added, 0 if none
 
 	// List of all mmapped-chunks
 	SpinLock                    mmapped_chunk_lock;
 	MmapChunkFooter            *mmapped_chunk_head;
 
+	// slab segments, and their spans that have free slots, by class, or no class
+	SpinLock                    slab_lock;
+	SlabSegment                *slab_segments;
+	SlabSegment::Span          *slab_partial[SlabSegment::CLASS_COUNT];
+	SlabSegment::Span          *slab_unused;
+	size_t                      slab_count;
+	size_t                      slab_released;
+	alignas(64) std::atomic<void*> slab_remote_frees;
+
+	// region mode: blocks are never freed one by one, reset() discards all of
+	// them at once. They don't count as blocks of the msource
+	bool                        region;
+	SpinLock                    region_lock;      // protects the chunk list
+	RegionChunk                *region_chunks;
+	std::atomic<RegionChunk*>   region_current;   // chunk that blocks are bumped from
+	size_t                      region_chunk_size;
+
 	BlockCount                  blocks;
 
-	// performance counters
-	//std::atomic_size_t          allocs_total;
-	//std::atomic_size_t          alloc_size_curr;
-	//std::atomic_size_t          alloc_size_total;
-	//std::atomic_size_t          alloc_size_max;
+#if MEM_SOURCE_THREAD_CACHE
+	// lazily created, indexed by ThreadSlots::current(). Published with
+	// release, as other threads read the caches' counters
+	std::atomic<ThreadCache*>   thread_caches[ThreadSlots::COUNT];
+#endif
+
+	// counters of threads without a thread cache
+	AllocCounters               shared_counters;
+
+	// bytes held by allocations (incl. thread caches), and their maximum
+	std::atomic_size_t          footprint;
+	std::atomic_size_t          footprint_peak;
+
+	// snapshot_all() calls that read the msource outside s_allsources_lock.
+	// destroy() waits for them
+	std::atomic_size_t          snapshot_readers;
 
 private:
 
-	MemSourceImpl(int n, size_t sz, const char *str, int home) {
+	MemSourceImpl(int n, size_t sz, const char *str, int home, PageSize pg, const Interleave *il) {
 		strncpy(description, str, NAME_LENGTH);
 
 		// Init msource
 		node = n;
 		node_home = home;
+		if (il != nullptr)
+			interleave = *il;
+		else
+			interleave.count = 0;
 		mmap_threshold = PGASUS_MMAP_THRESHOLD;
 		mem_size = sz;
+		growth = default_growth();
+		growth_last = 0;
+		page_policy = pg;
+		page_size = page_bytes(pg);
 		mmapped_chunk_head = nullptr;
+		slab_segments = nullptr;
+		for (SlabSegment::Span *&span : slab_partial)
+			span = nullptr;
+		slab_unused = nullptr;
+		slab_count = 0;
+		slab_released = 0;
+		slab_remote_frees = nullptr;
+		region = false;
+		region_chunks = nullptr;
+		region_current = nullptr;
+		region_chunk_size = 0;
+		footprint = 0;
+		footprint_peak = 0;
+		snapshot_readers = 0;
+#if MEM_SOURCE_THREAD_CACHE
+		for (std::atomic<ThreadCache*> &tc : thread_caches)
+			tc.store(nullptr, std::memory_order_relaxed);
+#endif
 
 		// Create native arena directly behind source header
 		void *arena_start = (void*) ALIGN_UP((intptr_t)this + sizeof(*this), 64);
 		size_t arena_size = ((intptr_t)this + sz) - (intptr_t)arena_start;
-		int dst_node = (node_home >= 0) ? node : -1;
-		native_arena = new (arena_start) Arena(this, arena_size, dst_node);
-		active_arena = native_arena;
+		native_arena = new (arena_start) Arena(this, arena_size, node_home >= 0);
+		arena_list = native_arena;
+		arena_count = 1;
+		for (std::atomic<Arena*> &stripe : stripe_arenas)
+			stripe = native_arena;
 
 		// Init spinlocks
 		if (!SpinLock_init(arena_lock)) {
@@ -311,26 +1063,32 @@ private:
         }
 		if (!SpinLock_init(mmapped_chunk_lock)) {
             assert(false);
+        }
+		if (!SpinLock_init(slab_lock)) {
+            assert(false);
+        }
+		if (!SpinLock_init(region_lock)) {
+            assert(false);
         }
 	}
 
 	~MemSourceImpl() {
-		assert(blocks.refs() == 0 && blocks.blocks() == 0);
+		assert(blocks.refs() == 0 && block_count() == 0);
 
 		// destroy all mspace arenas and return their mem to the system
-		Arena *arena_curr = active_arena;
+		Arena *arena_curr = arena_list;
 		Arena *arena_next = nullptr;
 
 		while (arena_curr) {
 			arena_next = arena_curr->next;
-			size_t sz = arena_curr->size;
+			size_t length = arena_curr->length;
 
 			// delete arena
 			arena_curr->~Arena();
 
 			// Only return non-native arena memory
 			if (arena_curr != native_arena) {
-				munmap(arena_curr, sz);
+				unmap(arena_curr, length);
 			}
 
 			arena_curr = arena_next;
@@ -341,10 +1099,33 @@ private:
 		MmapChunkFooter *mch_next = nullptr;
 		while (mch_curr != nullptr) {
 			mch_next = mch_curr->next;
-			munmap(mch_curr, mch_curr->size);
+			unmap(mch_curr, mch_curr->size);
 			mch_curr = mch_next;
 		}
 
+		// return slab segments
+		SlabSegment *seg_curr = slab_segments;
+		SlabSegment *seg_next = nullptr;
+		while (seg_curr != nullptr) {
+			seg_next = seg_curr->next;
+			SlabSegment::set_mapped(seg_curr, false);
+			unmap(seg_curr, SlabSegment::SIZE);
+			seg_curr = seg_next;
+		}
+
+		// return region chunks, along with the blocks still in them. Their
+		// pages stay marked as region memory, for free() to skip the blocks
+		RegionChunk *rch_curr = region_chunks;
+		RegionChunk *rch_next = nullptr;
+		if (rch_curr != nullptr)
+			s_regions_destroyed.store(true, std::memory_order_release);
+		while (rch_curr != nullptr) {
+			rch_next = rch_curr->next;
+			registerRegionMemory(rch_curr, rch_curr->size, nullptr, -1);
+			munmap(rch_curr, rch_curr->size);
+			rch_curr = rch_next;
+		}
+
 		// Destroy spinlocks
 		if (!SpinLock_destroy(arena_lock)) {
             assert(false);
@@ -352,58 +1133,671 @@ private:
 		if (!SpinLock_destroy(mmapped_chunk_lock)) {
             assert(false);
         }
+		if (!SpinLock_destroy(slab_lock)) {
+            assert(false);
+        }
+		if (!SpinLock_destroy(region_lock)) {
+            assert(false);
+        }
+	}
+
+	static inline size_t page_bytes(PageSize pg) {
+		switch (pg) {
+			case PageSize::Transparent:
+			case PageSize::Huge2M:
+				return (size_t)2 << 20;
+			case PageSize::Huge1G:
+				return (size_t)1 << 30;
+			default:
+				return MEM_PAGE_SIZE;
+		}
+	}
+
+	// map sz bytes backed by pages of the given policy. Once the hugetlbfs
+	// pool is exhausted, base pages are used instead, aligned like the huge
+	// pages would have been. sz must be a multiple of the policy's page size
+	static void *map_policy_pages(size_t sz, int where, PageSize pg, const char *name) {
+		static std::atomic_bool logged(false);
+
+		const size_t bytes = page_bytes(pg);
+		void *mem = callMmapPages(sz, where, bytes, pg == PageSize::Transparent);
+		if (mem == nullptr && (pg == PageSize::Huge2M || pg == PageSize::Huge1G)) {
+			mem = callMmapAligned(sz, where, bytes);
+			if (mem != nullptr && !logged.exchange(true, std::memory_order_relaxed))
+				numa::debug::log(numa::debug::INFO, "hugetlbfs pool exhausted, MemSource \"%s\" "
+					"falls back to base pages (not logged again)", name);
+		}
+		return mem;
+	}
+
+	// map sz bytes according to the page policy, and record them as the
+	// msource's in the address map. sz must be a multiple of page_size
+	inline void *map_pages(size_t sz, int where) const {
+		void *mem = map_policy_pages(sz, where, page_policy, description);
+		if (mem != nullptr)
+			registerMemory(mem, sz, const_cast<MemSourceImpl*>(this), where);
+		return mem;
+	}
+
+	// counterpart of map_pages
+	static inline void unmap(void *mem, size_t sz) {
+		unregisterMemory(mem, sz);
+		munmap(mem, sz);
+	}
+
+	// map sz bytes for allocations, on the msource's node or interleaved
+	inline void *map_data(size_t sz) const {
+		const int where = node.load(std::memory_order_acquire);
+		void *mem = map_pages(sz, where);
+		if (mem != nullptr && where < 0 && interleave.count > 0)
+			interleave.apply(mem, sz, page_size);
+		return mem;
+	}
+
+	// map a slab segment, aligned to its size and placed like the msource's data
+	inline void *map_segment() const {
+		static constexpr size_t sz = SlabSegment::SIZE;
+
+		// pages of the segment's size are aligned to it anyway
+		const int where = node.load(std::memory_order_acquire);
+		void *mem = (page_size == sz) ? map_pages(sz, where) : nullptr;
+		if (mem == nullptr && (mem = callMmapAligned(sz, where, sz)) != nullptr)
+			registerMemory(mem, sz, const_cast<MemSourceImpl*>(this), where);
+		if (mem != nullptr && where < 0 && interleave.count > 0)
+			interleave.apply(mem, sz, std::min(page_size, sz));
+		return mem;
+	}
+
+	static inline uint64_t now_ns() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+	}
+
+	// size of the next arena, with room for at least needed bytes. exhausted
+	// is the arena that ran out of space, if that is why a new one is needed.
+	// Expects arena_lock to be held
+	inline size_t next_arena_size(size_t needed, Arena *exhausted) {
+		// arenas used up faster grow faster, ones lasting longer don't grow.
+		// Each arena advances the growth once, arenas added because of lock
+		// contention don't
+		static constexpr uint64_t FAST_NS = 100 * 1000 * 1000ull;
+		static constexpr uint64_t SLOW_NS = 10 * 1000 * 1000 * 1000ull;
+
+		size_t sz = std::max(growth_last, growth.min_arena);
+		if (exhausted != nullptr && exhausted->created != 0) {
+			const uint64_t lasted = now_ns() - exhausted->created;
+			exhausted->created = 0;
+			const size_t limit = growth.max_arena / growth.factor;
+			if (lasted < SLOW_NS)
+				sz = (sz > limit) ? growth.max_arena : sz * growth.factor;
+			if (lasted < FAST_NS)
+				sz = (sz > limit) ? growth.max_arena : sz * growth.factor;
+		}
+		sz = std::min(sz, growth.max_arena);
+
+		growth_last = sz;
+
+		// the arena header and the mspace's bookkeeping come on top
+		return std::max(sz, needed + ALIGN_UP(sizeof(Arena), 64) + ((size_t)64 << 10));
 	}
 
+	// expects arena_lock to be held
 	inline Arena* create_new_arena(size_t arena_size)
 	{
-		assert (active_arena);
-		assert (!active_arena->prev);
+		assert (arena_list);
+		assert (!arena_list->prev);
 
 		// Allocate system memory
-		int where = (node_home >= 0) ? node_home : node;
-		void *mem = callMmap(arena_size, where);
+		arena_size = ALIGN_UP(arena_size, page_size);
+		void *mem = (node_home >= 0) ? map_pages(arena_size, node_home) : map_data(arena_size);
 		if (mem == nullptr) return nullptr;
 
-		int dst_node = (node_home >= 0) ? node : -1;
-		Arena *arena = new (mem) Arena(this, arena_size, dst_node);
-		arena->next = active_arena;
-		active_arena->prev = arena;
-		active_arena = arena;
+		Arena *arena = new (mem) Arena(this, arena_size, node_home >= 0);
+		if (arena->msp == nullptr) {
+			arena->~Arena();
+			unmap(mem, arena_size);
+			return nullptr;
+		}
+		arena->created = now_ns();
+		arena->next = arena_list;
+		arena_list->prev = arena;
+		arena_list = arena;
+		arena_count++;
 
 		return arena;
 	}
 
+	// expects arena_lock to be held. returns the arena with the most free
+	// space, if it has at least the given number of bytes left
+	inline Arena* find_arena(size_t bytes, const Arena *exclude) {
+		Arena *best = nullptr;
+		size_t best_free = bytes;
+
+		for (Arena *curr = arena_list; curr != nullptr; curr = curr->next) {
+			const size_t free_space = curr->free_space();
+			if (curr != exclude && free_space >= best_free) {
+				best = curr;
+				best_free = free_space;
+			}
+		}
+
+		return best;
+	}
+
+	static inline size_t arena_stripe() {
+		const int slot = ThreadSlots::current();
+		return (slot >= 0) ? (size_t)slot % ARENA_STRIPES : 0;
+	}
+
+	// allocate up to n chunks of given size from the calling thread's arena.
+	// if it is exhausted or busy, switch the stripe to the arena with the most
+	// free space, or to a new one. returns number of chunks, zeroed is set
+	// for the last one
+	inline size_t alloc_chunks(size_t bytes, ChunkFooter **chunks, size_t n,
+			bool *zeroed = nullptr) {
+		const size_t stripe = arena_stripe();
+		Arena *arena = stripe_arenas[stripe].load(std::memory_order_acquire);
+
+		// fast path: the stripe's arena is free and can satisfy the request
+		bool contended = false;
+		size_t count = arena->try_alloc_batch(bytes, chunks, n, contended, zeroed);
+		if (count > 0)
+			return count;
+
+		SpinLock_lock(arena_lock);
+
+		// see if another arena may qualify as the stripe's new arena
+		const size_t needed = n * (bytes + ChunkFooter::DATA_OFFSET());
+		Arena *candidate = find_arena(needed, arena);
+
+		// don't spread out indefinitely because of lock contention
+		if (candidate == nullptr && contended && arena_count >= ARENA_STRIPES)
+			candidate = arena;
+
+		if (candidate != nullptr)
+			count = candidate->alloc_batch(bytes, chunks, n, zeroed);
+
+		// if not, create new arena for the stripe. The stripe's arena is
+		// used up, unless it was only busy
+		if (count == 0) {
+			Arena *exhausted = (!contended || candidate == arena) ? arena : nullptr;
+			candidate = create_new_arena(next_arena_size(needed, exhausted));
+			if (candidate != nullptr) {
+				count = candidate->alloc_batch(bytes, chunks, n, zeroed);
+			}
+		}
+
+		if (count > 0)
+			stripe_arenas[stripe].store(candidate, std::memory_order_release);
+
+		SpinLock_unlock(arena_lock);
+
+		// allocations may not come back to the old arena, which would leave
+		// its remote frees stranded
+		if (count > 0 && candidate != arena)
+			arena->try_drain_remote();
+
+		return count;
+	}
+
+	inline ChunkFooter *alloc_chunk(size_t bytes, bool *zeroed = nullptr) {
+		ChunkFooter *chunk = nullptr;
+		alloc_chunks(bytes, &chunk, 1, zeroed);
+		return chunk;
+	}
+
+	// return chunks to their arenas, locking each arena once per run of chunks
+	static void free_chunks(ChunkFooter **chunks, size_t n) {
+		size_t i = 0;
+		while (i < n) {
+			Arena *arena = chunks[i]->arena();
+			SpinLock_lock(arena->mspace_lock);
+			arena->drain_remote_locked();
+			for (; i < n && chunks[i]->arena() == arena; i++)
+				arena->free_locked(chunks[i]);
+			SpinLock_unlock(arena->mspace_lock);
+		}
+	}
+
+	static inline void span_push(SlabSegment::Span *&head, SlabSegment::Span *span) {
+		span->prev = nullptr;
+		span->next = head;
+		if (head != nullptr)
+			head->prev = span;
+		head = span;
+	}
+
+	static inline void span_unlink(SlabSegment::Span *&head, SlabSegment::Span *span) {
+		if (span->prev != nullptr)
+			span->prev->next = span->next;
+		else
+			head = span->next;
+		if (span->next != nullptr)
+			span->next->prev = span->prev;
+		span->prev = span->next = nullptr;
+	}
+
+	static inline SlabSegment *segment_of(SlabSegment::Span *span) {
+		return reinterpret_cast<SlabSegment*>((uintptr_t)span & ~(SlabSegment::SIZE - 1));
+	}
+
+	// expects slab_lock to be held
+	inline bool add_slab_segment() {
+		void *mem = map_segment();
+		if (mem == nullptr)
+			return false;
+
+		SlabSegment *seg = new (mem) SlabSegment(this, slab_segments);
+		for (size_t i = SlabSegment::SPAN_COUNT - 1; i > 0; i--)
+			span_push(slab_unused, &seg->spans[i]);
+		slab_segments = seg;
+		slab_count++;
+		SlabSegment::set_mapped(seg, true);
+		return true;
+	}
+
+	// take up to n slots of the given class, preferring recently freed ones
+	// over untouched ones. expects slab_lock to be held
+	inline size_t alloc_slots_locked(size_t cls, void **slots, size_t n) {
+		const size_t size = SlabSegment::class_size(cls);
+		const size_t capacity = SlabSegment::class_slots(cls);
+		size_t count = 0;
+
+		drain_remote_slots_locked();
+		while (count < n) {
+			SlabSegment::Span *span = slab_partial[cls];
+			if (span == nullptr) {
+				if (slab_unused == nullptr && !add_slab_segment())
+					break;
+				span = slab_unused;
+				span_unlink(slab_unused, span);
+				span->free = nullptr;
+				span->used = 0;
+				span->carved = 0;
+				span->cls = (uint16_t)cls;
+				span->released = false;
+				span_push(slab_partial[cls], span);
+			}
+
+			while (count < n && span->free != nullptr) {
+				slots[count++] = span->free;
+				span->free = *static_cast<void**>(span->free);
+				span->used++;
+			}
+			char *data = segment_of(span)->span_data(span);
+			while (count < n && span->carved < capacity) {
+				slots[count++] = data + span->carved++ * size;
+				span->used++;
+			}
+
+			// full spans are in no list
+			if (span->used == capacity)
+				span_unlink(slab_partial[cls], span);
+		}
+
+		return count;
+	}
+
+	// return a slot to its span. Empty spans become unused, unless they are
+	// the last partial one of their class. expects slab_lock to be held
+	inline void free_slot_locked(void *p) {
+		SlabSegment::Span *span = SlabSegment::of(p)->span_of(p);
+		const size_t cls = span->cls;
+
+		if (span->used == SlabSegment::class_slots(cls))
+			span_push(slab_partial[cls], span);
+		*static_cast<void**>(p) = span->free;
+		span->free = p;
+		footprint.fetch_sub(SlabSegment::class_size(cls), std::memory_order_relaxed);
+
+		if (--span->used == 0 && (span != slab_partial[cls] || span->next != nullptr)) {
+			span_unlink(slab_partial[cls], span);
+			span->cls = SlabSegment::NO_CLASS;
+			span_push(slab_unused, span);
+		}
+	}
+
+	// slots freed by threads on other nodes, returned on the next allocation
+	inline void free_slot_remote(void *p) {
+		void *head = slab_remote_frees.load(std::memory_order_relaxed);
+		do {
+			*static_cast<void**>(p) = head;
+		} while (!slab_remote_frees.compare_exchange_weak(head, p,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// expects slab_lock to be held
+	inline void drain_remote_slots_locked() {
+		if (slab_remote_frees.load(std::memory_order_relaxed) == nullptr)
+			return;
+
+		void *p = slab_remote_frees.exchange(nullptr, std::memory_order_acquire);
+		while (p != nullptr) {
+			void *next = *static_cast<void**>(p);
+			free_slot_locked(p);
+			p = next;
+		}
+	}
+
+	inline void grow_footprint(size_t bytes) {
+		const size_t now = footprint.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		size_t peak = footprint_peak.load(std::memory_order_relaxed);
+		while (now > peak && !footprint_peak.compare_exchange_weak(peak, now,
+				std::memory_order_relaxed));
+	}
+
+	// count blocks in the calling thread's shard, given its thread cache if
+	// known, or centrally. remove_block() returns true for the source's last
+	// block, once it is abandoned
+	inline void add_block(ThreadCache *tc = nullptr) {
+#if MEM_SOURCE_THREAD_CACHE
+		if (tc == nullptr) {
+			const int slot = ThreadSlots::current();
+			tc = (slot >= 0) ? thread_caches[slot].load(std::memory_order_acquire) : nullptr;
+		}
+		if (tc != nullptr) {
+			BlockCount::addBlock(tc->blocks);
+			return;
+		}
+#endif
+		blocks.addBlock();
+	}
+
+	inline bool remove_block(ThreadCache *tc = nullptr) {
+#if MEM_SOURCE_THREAD_CACHE
+		if (tc == nullptr) {
+			const int slot = ThreadSlots::current();
+			tc = (slot >= 0) ? thread_caches[slot].load(std::memory_order_acquire) : nullptr;
+		}
+		if (tc != nullptr)
+			return blocks.removeBlock(tc->blocks, tc->blocks_busy);
+#endif
+		return blocks.removeBlock();
+	}
+
+	// all blocks, while the shards don't change
+	inline ssize_t block_count() const {
+		ssize_t result = blocks.blocks();
+#if MEM_SOURCE_THREAD_CACHE
+		for (const std::atomic<ThreadCache*> &slot : thread_caches)
+			if (ThreadCache *tc = slot.load(std::memory_order_acquire))
+				result += tc->blocks.load(std::memory_order_relaxed);
+#endif
+		return result;
+	}
+
+	// counters of the calling thread, given its thread cache if known. Sets
+	// shared, if other threads may update them concurrently
+	inline AllocCounters &thread_counters(bool &shared, ThreadCache *tc = nullptr) {
+#if MEM_SOURCE_THREAD_CACHE
+		if (tc == nullptr) {
+			const int slot = ThreadSlots::current();
+			tc = (slot >= 0) ? thread_caches[slot].load(std::memory_order_acquire) : nullptr;
+		}
+		if (tc != nullptr) {
+			shared = false;
+			return tc->counters;
+		}
+#endif
+		shared = true;
+		return shared_counters;
+	}
+
+#if MEM_SOURCE_THREAD_CACHE
+	inline ThreadCache *get_thread_cache() {
+		const int slot = ThreadSlots::current();
+		if (slot < 0)
+			return nullptr;
+
+		ThreadCache *tc = thread_caches[slot].load(std::memory_order_acquire);
+		if (tc == nullptr) {
+			ChunkFooter *chunk = alloc_chunk(sizeof(ThreadCache));
+			if (chunk == nullptr)
+				return nullptr;
+			tc = new (chunk->TO_POINTER()) ThreadCache();
+			thread_caches[slot].store(tc, std::memory_order_release);
+		}
+		return tc;
+	}
+
+	// take a chunk from the thread cache, refill it in one batch if empty
+	inline ChunkFooter *alloc_cached(ThreadCache *tc, size_t cls) {
+		if (tc->bins[cls].count == 0) {
+			ChunkFooter *chunks[ThreadCache::BATCH];
+			size_t n = alloc_chunks(ThreadCache::class_size(cls), chunks, ThreadCache::BATCH);
+			for (size_t i = n; i > 0; i--)
+				tc->push(cls, chunks[i-1]);
+		}
+		return tc->pop(cls);
+	}
+
+	// put a chunk into the thread cache, drain one batch if it is full.
+	// returns false, if the chunk can not be cached
+	inline bool free_cached(ThreadCache *tc, ChunkFooter *ch, size_t usable) {
+		const size_t cls = ThreadCache::class_of_chunk(usable);
+		if (cls < ThreadCache::FIRST_CLASS || cls >= ThreadCache::CLASS_COUNT)
+			return false;
+
+		if (tc->bins[cls].count >= ThreadCache::CAPACITY) {
+			ChunkFooter *chunks[ThreadCache::BATCH];
+			for (size_t i = 0; i < ThreadCache::BATCH; i++)
+				chunks[i] = tc->pop(cls);
+			free_chunks(chunks, ThreadCache::BATCH);
+		}
+
+		tc->push(cls, ch);
+		return true;
+	}
+#endif
+
+	// allocate a slab slot of the given class, refilling the thread cache
+	// (if given) in one batch
+	inline void *alloc_slot(size_t cls, ThreadCache *tc) {
+		const size_t size = SlabSegment::class_size(cls);
+		void *p = nullptr;
+
+#if MEM_SOURCE_THREAD_CACHE
+		if (tc != nullptr) {
+			if (tc->slabs[cls].count == 0) {
+				void *slots[ThreadCache::BATCH];
+				SpinLock_lock(slab_lock);
+				size_t n = alloc_slots_locked(cls, slots, ThreadCache::BATCH);
+				SpinLock_unlock(slab_lock);
+				grow_footprint(n * size);
+				for (size_t i = n; i > 0; i--)
+					tc->push_slab(cls, slots[i-1]);
+			}
+			return tc->pop_slab(cls);
+		}
+#endif
+
+		SpinLock_lock(slab_lock);
+		size_t n = alloc_slots_locked(cls, &p, 1);
+		SpinLock_unlock(slab_lock);
+		if (n > 0)
+			grow_footprint(size);
+		return p;
+	}
+
+	// cls is the class of the slot's span
+	bool free_slot(void *p, size_t cls) {
+		bool shared;
+		const size_t size = SlabSegment::class_size(cls);
+		const int thread_node = curr_thread_node();
+
+		if (node >= 0 && thread_node >= 0 && thread_node != node) {
+			thread_counters(shared).count_free(size, true, shared);
+			// don't pull the slab lock across the interconnect
+			free_slot_remote(p);
+			return remove_block();
+		}
+
+#if MEM_SOURCE_THREAD_CACHE
+		ThreadCache *tc = get_thread_cache();
+		thread_counters(shared, tc).count_free(size, false, shared);
+		if (tc != nullptr) {
+			if (tc->slabs[cls].count >= ThreadCache::CAPACITY) {
+				SpinLock_lock(slab_lock);
+				for (size_t i = 0; i < ThreadCache::BATCH; i++)
+					free_slot_locked(tc->pop_slab(cls));
+				SpinLock_unlock(slab_lock);
+			}
+			tc->push_slab(cls, p);
+			return remove_block(tc);
+		}
+#else
+		thread_counters(shared).count_free(size, false, shared);
+#endif
+
+		SpinLock_lock(slab_lock);
+		free_slot_locked(p);
+		SpinLock_unlock(slab_lock);
+		return remove_block();
+	}
+
 	bool free_impl(void *p, ChunkFooter *ch) {
-		if (ch->arena != nullptr) {
-			ch->arena->free(p, ch);
-			// TODO update alloc end ptr?
+		ThreadCache *tc = nullptr;
+		bool shared;
+
+		Arena *arena = ch->arena();
+		if (arena != nullptr) {
+			const int thread_node = curr_thread_node();
+
+			// cached chunks are accounted with their class' size, which
+			// spares reading the mspace's chunk header
+			const int cls = ch->cache_class();
+			const size_t usable = (cls >= 0) ? ThreadCache::class_size(cls)
+				: dlmalloc_usable_size((void*)ch) - ChunkFooter::DATA_OFFSET();
+
+			if (node >= 0 && thread_node >= 0 && thread_node != node) {
+				thread_counters(shared).count_free(usable, true, shared);
+				// don't pull the arena's lock across the interconnect
+				arena->free_remote(ch);
+			} else {
+#if MEM_SOURCE_THREAD_CACHE
+				tc = get_thread_cache();
+#endif
+				thread_counters(shared, tc).count_free(usable, false, shared);
+#if MEM_SOURCE_THREAD_CACHE
+				if (tc == nullptr || !free_cached(tc, ch, usable))
+#endif
+				arena->free(p, ch);
+			}
 		}
 		else {
-			MmapChunkFooter *mch = MmapChunkFooter::FROM_POINTER(p);
+			MmapChunkFooter *mch = MmapChunkFooter::FROM_POINTER(ch->TO_POINTER());
+			thread_counters(shared).count_free(mch->size, false, shared);
+			footprint.fetch_sub(mch->size, std::memory_order_relaxed);
 
+			// pinned chunks are unmapped once they are unpinned
 			SpinLock_lock(mmapped_chunk_lock);
+			const bool pinned = mch->pins != 0;
+			if (pinned)
+				mch->freed = true;
+			else
+				unlink_chunk_locked(mch);
+			SpinLock_unlock(mmapped_chunk_lock);
 
-			// remove from mmap-chunk list
-			if (!mch->prev) {
-				mmapped_chunk_head = mch->next;
-			} else {
-				mch->prev->next = mch->next;
-			}
+			if (!pinned)
+				unmap(mch, mch->size);
+		}
 
-			if (mch->next) {
-				mch->next->prev = mch->prev;
-			}
+		return remove_block(tc);
+	}
 
+	// remove from mmap-chunk list. expects mmapped_chunk_lock to be held
+	inline void unlink_chunk_locked(MmapChunkFooter *mch) {
+		if (!mch->prev) {
+			mmapped_chunk_head = mch->next;
+		} else {
+			mch->prev->next = mch->next;
+		}
+
+		if (mch->next) {
+			mch->next->prev = mch->prev;
+		}
+	}
+
+	// pin the first chunk from curr on that is not freed, and not placed on
+	// the given node (unless skip_node is -1). Expects mmapped_chunk_lock
+	// to be held
+	static inline MmapChunkFooter *pin_chunk_locked(MmapChunkFooter *curr, int skip_node = -1) {
+		while (curr != nullptr && (curr->freed || (skip_node >= 0 && curr->node == skip_node)))
+			curr = curr->next;
+		if (curr != nullptr)
+			curr->pins++;
+		return curr;
+	}
+
+	// returns true if the chunk has been freed meanwhile, and must be
+	// unmapped now. Expects mmapped_chunk_lock to be held
+	inline bool unpin_chunk_locked(MmapChunkFooter *mch) {
+		if (--mch->pins != 0 || !mch->freed)
+			return false;
+		unlink_chunk_locked(mch);
+		return true;
+	}
+
+	// expects the size change of an allocated block, and the change of the
+	// size it is accounted with, if that differs
+	inline void count_resize(ssize_t delta, ssize_t counted_delta) {
+		bool shared;
+		thread_counters(shared).count_resize(counted_delta, shared);
+		if (delta > 0)
+			grow_footprint((size_t)delta);
+		else
+			footprint.fetch_sub((size_t)-delta, std::memory_order_relaxed);
+	}
+
+	// resize an mmapped block, moving its pages if needed. Returns the new
+	// chunk, or nullptr if the pages can not be remapped
+	MmapChunkFooter *remap_chunk(MmapChunkFooter *mch, size_t bytes) {
+		const size_t sz = ALIGN_UP(bytes + MmapChunkFooter::DATA_OFFSET(), page_size);
+		const size_t old_sz = mch->size;
+		if (sz == old_sz)
+			return mch;
+
+		// neighbours in the chunk list point to the chunk's address. The
+		// old range is forgotten while still owned, as it may be reused as
+		// soon as the chunk has moved. Pinned chunks must stay in place
+		SpinLock_lock(mmapped_chunk_lock);
+		if (mch->pins != 0) {
 			SpinLock_unlock(mmapped_chunk_lock);
+			return nullptr;
+		}
+		unregisterMemory((void*) mch, old_sz);
+		void *mem = mremap((void*) mch, old_sz, sz, MREMAP_MAYMOVE);
+		if (mem == MAP_FAILED) {
+			registerMemory((void*) mch, old_sz, this, mch->node);
+			SpinLock_unlock(mmapped_chunk_lock);
+			return nullptr;
+		}
 
-			munmap(mch, mch->size);
+		MmapChunkFooter *chunk = static_cast<MmapChunkFooter*>(mem);
+		chunk->size = sz;
+		const int chunk_node = chunk->node;
+		registerMemory(mem, sz, this, chunk_node);
+		if (!chunk->prev) {
+			mmapped_chunk_head = chunk;
+		} else {
+			chunk->prev->next = chunk;
+		}
+		if (chunk->next) {
+			chunk->next->prev = chunk;
 		}
+		SpinLock_unlock(mmapped_chunk_lock);
 
-		bool ret = blocks.removeBlock();
+		// the grown range is bound like the rest of the mapping, but
+		// interleaving has to be continued
+		if (sz > old_sz && chunk_node < 0 && interleave.count > 0)
+			interleave.apply((char*) mem + old_sz, sz - old_sz, page_size);
 
-		return ret;
+		count_resize((ssize_t)sz - (ssize_t)old_sz, (ssize_t)sz - (ssize_t)old_sz);
+		return chunk;
 	}
 
+
 	static inline ChunkFooter* get_footer_for_mem(void *p) {
 		ChunkFooter *ch = ChunkFooter::FROM_POINTER(p);
 
@@ -415,14 +1809,6 @@ private:
 		return ch;
 	}
 
-	static void add_pages_to_vector(std::vector<void*> &v, void *start, void *end) {
-		intptr_t istart = ALIGN_DOWN((intptr_t) start, MEM_PAGE_SIZE);
-		intptr_t iend = ALIGN_DOWN((intptr_t) end, MEM_PAGE_SIZE);
-		for (intptr_t i = istart; i <= iend; i += MEM_PAGE_SIZE) {
-			v.push_back((void*) i);
-		}
-	}
-
 	typedef std::vector<MemSourceImpl*, numa::util::MmapAllocator<MemSourceImpl*>> MemSourceVector;
 
 	static numa::SpinLock& s_allsources_lock() {
@@ -444,23 +1830,192 @@ private:
 	}
 
 public:
+	// value of an environment variable, with an optional K, M or G suffix.
+	// Invalid values and ones above limit are reported, and the fallback is
+	// used instead
+	static size_t env_size(const char *name, size_t fallback, size_t limit) {
+		const char *str = getenv(name);
+		if (str == nullptr)
+			return fallback;
+
+		char *end;
+		errno = 0;
+		unsigned long long value = strtoull(str, &end, 0);
+		bool valid = (end != str && errno == 0 && strchr(str, '-') == nullptr);
+		unsigned shift = 0;
+		switch (*end) {
+			case 'G': case 'g': shift = 30; end++; break;
+			case 'M': case 'm': shift = 20; end++; break;
+			case 'K': case 'k': shift = 10; end++; break;
+		}
+		valid = valid && *end == '\0' && value <= (limit >> shift);
+		if (!valid) {
+			fprintf(stderr, "Invalid %s value (%s), using default.\n", name, str);
+			return fallback;
+		}
+		return (size_t)value << shift;
+	}
+
+	// growth policy of new msources, read from the environment once
+	static const msource_growth &default_growth() {
+		static const msource_growth defaults = [] {
+			// arenas can't be larger than the machine's memory
+			const size_t mem = (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE);
+			return sanitize_growth(msource_growth {
+				env_size("NUMA_ARENA_MIN", (size_t)4 << 20, mem),
+				env_size("NUMA_ARENA_MAX", (size_t)1 << 30, mem),
+				env_size("NUMA_ARENA_FACTOR", 2, SIZE_MAX)
+			});
+		}();
+		return defaults;
+	}
+
+	static msource_growth sanitize_growth(msource_growth g) {
+		static constexpr size_t MAX_FACTOR = 16;
+		g.min_arena = std::max(g.min_arena, (size_t)1 << 20);
+		g.max_arena = std::max(g.max_arena, g.min_arena);
+		g.factor = std::min(std::max(g.factor, (size_t)1), MAX_FACTOR);
+		return g;
+	}
+
+	msource_growth get_growth() {
+		SpinLock_lock(arena_lock);
+		msource_growth result = growth;
+		SpinLock_unlock(arena_lock);
+		return result;
+	}
+
+	void set_growth(const msource_growth &g) {
+		SpinLock_lock(arena_lock);
+		growth = sanitize_growth(g);
+		SpinLock_unlock(arena_lock);
+	}
 
 	static MemSourceVector& s_allsources() {
 		static MemSourceVector *msv = new (callMmap(4096, -1)) MemSourceVector();
 		return *msv;
 	}
 
-	static MemSourceImpl *create(int phys_node, size_t sz, const char *str, int phys_home_node) {
-		MemSourceImpl *ms = new (callMmap(sz, phys_node)) MemSourceImpl(phys_node, sz, str, phys_home_node);
+	static std::vector<msource_snapshot> snapshot_all() {
+		std::vector<MemSourceImpl*> sources;
+
+		// allocating may create a MemSource and thus take the lock, so the
+		// vector must not grow while it is held. The msources found are kept
+		// from being destroyed until their stats are read, without the lock
+		for (;;) {
+			size_t count;
+			{
+				std::lock_guard<numa::SpinLock> g(s_allsources_lock());
+				count = s_allsources().size();
+			}
+			sources.reserve(count);
+
+			std::lock_guard<numa::SpinLock> g(s_allsources_lock());
+			if (s_allsources().size() > sources.capacity())
+				continue;
+
+			for (MemSourceImpl *ms : s_allsources()) {
+				if (ms == nullptr)
+					continue;
+				ms->snapshot_readers.fetch_add(1, std::memory_order_relaxed);
+				sources.push_back(ms);
+			}
+			break;
+		}
+
+		std::vector<msource_snapshot> result(sources.size());
+		for (size_t i = 0; i < sources.size(); i++) {
+			MemSourceImpl *ms = sources[i];
+			msource_snapshot &snap = result[i];
+			strncpy(snap.description, ms->description, sizeof(snap.description) - 1);
+			snap.description[sizeof(snap.description) - 1] = '\0';
+			snap.node = ms->node;
+			snap.info = ms->stats();
+			ms->snapshot_readers.fetch_sub(1, std::memory_order_release);
+		}
+		return result;
+	}
+
+	static MemSourceImpl *create(int phys_node, size_t sz, const char *str, int phys_home_node,
+			PageSize pages = PageSize::Default, const Interleave *il = nullptr) {
+		sz = ALIGN_UP(sz, page_bytes(pages));
+		void *mem = map_policy_pages(sz, phys_node, pages, str);
+		if (mem == nullptr)
+			return nullptr;
+
+		// the native arena lies within this mapping, if there is no home node
+		if (il != nullptr && phys_home_node < 0)
+			il->apply(mem, sz, page_bytes(pages));
+
+		MemSourceImpl *ms = new (mem) MemSourceImpl(phys_node, sz, str, phys_home_node, pages, il);
+
+		// a separately mapped native arena may be out of memory
+		if (ms->native_arena->msp == nullptr) {
+			ms->~MemSourceImpl();
+			munmap(mem, sz);
+			return nullptr;
+		}
+
+		registerMemory(mem, sz, ms, phys_node);
 		add_msource(ms);
 		return ms;
 	}
 
+	// a region's own mapping only holds its header, its blocks come from
+	// chunks of chunk_sz bytes
+	static MemSourceImpl *create_region(int phys_node, size_t chunk_sz, const char *str,
+			PageSize pages) {
+		static constexpr size_t REGION_HEADER_SIZE = (size_t)64 << 10;
+
+		MemSourceImpl *ms = create(phys_node, sizeof(MemSourceImpl) + REGION_HEADER_SIZE, str, -1, pages);
+		if (ms == nullptr)
+			return nullptr;
+
+		ms->region = true;
+		ms->region_chunk_size = ALIGN_UP(std::max(chunk_sz, REGION_HEADER_SIZE), ms->page_size);
+		return ms;
+	}
+
+	static MemSourceImpl *create_interleaved(const int *nodes, const size_t *weights, size_t count,
+			size_t sz, const char *str, PageSize pages) {
+		Interleave il;
+		il.count = std::min(count, Interleave::MAX_NODES);
+
+		size_t max_weight = 0;
+		for (size_t i = 0; i < il.count; i++)
+			max_weight = std::max(max_weight, (weights != nullptr) ? weights[i] : 1);
+
+		// scale weights to 1..MAX_WEIGHT (0 stays 0), then divide by their gcd
+		unsigned divisor = 0;
+		for (size_t i = 0; i < il.count; i++) {
+			const size_t w = (weights != nullptr) ? weights[i] : 1;
+			il.nodes[i] = nodes[i];
+			il.weights[i] = (w == 0) ? 0 : std::max(1u,
+				(unsigned)((w * Interleave::MAX_WEIGHT + max_weight / 2) / max_weight));
+
+			unsigned a = divisor, b = il.weights[i];
+			while (b != 0) {
+				unsigned t = a % b;
+				a = b;
+				b = t;
+			}
+			divisor = a;
+		}
+		for (size_t i = 0; divisor > 1 && i < il.count; i++)
+			il.weights[i] /= divisor;
+
+		return create(-1, sz, str, -1, pages, &il);
+	}
+
 	static void destroy(MemSourceImpl *ms) {
+		// no snapshot finds the msource anymore, wait for the running ones
 		remove_msource(ms);
+		while (ms->snapshot_readers.load(std::memory_order_acquire) != 0)
+			sched_yield();
+		trace::forget(ms);
 		size_t sz = ms->mem_size;
 		ms->~MemSourceImpl();
-		munmap(ms, sz);
+		unmap(ms, sz);
 	}
 
 	void ref() {
@@ -473,11 +2028,24 @@ public:
 			char buff[4096];
 			getDescription(buff, 4096);
 			numa::debug::log(numa::debug::DEBUG, "Abandon MemSource %s", buff);
+
+			// blocks that outlive their source's handles may be leaks,
+			// unlike the blocks of regions
+			if (!region && trace::live_samples.load(std::memory_order_relaxed) != 0)
+				trace::report(this, buff, true, stderr);
 		}
 
-		// last usage -> delete
+		// last reference -> count the remaining blocks centrally, and delete
+		// the source if there are none
 		if (blocks.deref()) {
-			destroy(this);
+			blocks.abandon();
+#if MEM_SOURCE_THREAD_CACHE
+			for (std::atomic<ThreadCache*> &slot : thread_caches)
+				if (ThreadCache *tc = slot.load(std::memory_order_acquire))
+					blocks.flush(tc->blocks, tc->blocks_busy);
+#endif
+			if (blocks.release())
+				destroy(this);
 		}
 	}
 
@@ -485,93 +2053,371 @@ public:
 		snprintf(buffer, sz, "%s [%p] n=%d blks=%zd",
 			description,
 			(void*) this,
-			node,
-			blocks.blocks());
+			node.load(std::memory_order_relaxed),
+			block_count());
 	}
 
 	static inline size_t get_block_size(void *p) {
+		if (SlabSegment *seg = SlabSegment::of(p))
+			return SlabSegment::class_size(seg->span_of(p)->cls);
+
 		ChunkFooter *ch = get_footer_for_mem(p);
+		if (ch->source->region)
+			return ch->arena_tag;
 
-		if (ch->arena != nullptr) {
-			return dlmalloc_usable_size((void*)ch) - ChunkFooter::DATA_OFFSET();
+		// aligned blocks start behind the chunk's data
+		const size_t offset = (intptr_t)p - (intptr_t)ch->TO_POINTER();
+
+		if (ch->arena() != nullptr) {
+			return dlmalloc_usable_size((void*)ch) - ChunkFooter::DATA_OFFSET() - offset;
 		} else {
-			return MmapChunkFooter::FROM_POINTER(p)->size;
+			return MmapChunkFooter::FROM_POINTER(ch->TO_POINTER())->size
+				- MmapChunkFooter::DATA_OFFSET() - offset;
+		}
+	}
+
+	// resize a block without copying its contents: within its arena, or by
+	// remapping its pages. Returns the block's (new) address, or nullptr if
+	// it has to be copied
+	static void *resize(void *p, size_t bytes) {
+		// slots only stay put within their class, which free_sized() derives
+		// from the size
+		if (SlabSegment *seg = SlabSegment::of(p))
+			return (SlabSegment::class_of_request(bytes) == seg->span_of(p)->cls) ? p : nullptr;
+
+		ChunkFooter *ch = get_footer_for_mem(p);
+		MemSourceImpl *src = ch->source;
+		if (src->region)
+			return src->resize_region(p, ch, bytes);
+
+		// blocks with an alignment offset are not resized
+		if (ch->TO_POINTER() != p)
+			return nullptr;
+
+		Arena *arena = ch->arena();
+		if (arena != nullptr) {
+			// keep large blocks out of the arenas
+			if (bytes >= src->mmap_threshold)
+				return nullptr;
+
+			// a cached chunk is accounted with its class' size, and the
+			// resized chunk must not go back into that class
+			const int cls = ch->cache_class();
+			const size_t counted = (cls >= 0) ? ThreadCache::class_size(cls)
+				: dlmalloc_usable_size((void*)ch) - ChunkFooter::DATA_OFFSET();
+
+			ssize_t delta;
+			if (!arena->resize(ch, bytes, delta))
+				return nullptr;
+			ch->set_arena(arena);
+			src->count_resize(delta, (ssize_t)(dlmalloc_usable_size((void*)ch)
+				- ChunkFooter::DATA_OFFSET()) - (ssize_t)counted);
+			return p;
 		}
+
+		MmapChunkFooter *mch = src->remap_chunk(MmapChunkFooter::FROM_POINTER(p), bytes);
+		return (mch != nullptr) ? mch->TO_POINTER() : nullptr;
 	}
 
 	inline int get_node() const {
 		return node;
 	}
 
-	size_t migrate(int dst) {
-		std::vector<void*> pages;
+	inline PageSize get_page_size() const {
+		return page_policy;
+	}
+
+	// mapping that holds the allocations of the given arena
+	inline void arena_data_range(const Arena *arena, void *&start, size_t &len) const {
+		if (!arena->native) {
+			start = arena->base;
+			len = arena->size;
+		} else if (arena == native_arena) {
+			start = (void*) this;
+			len = mem_size;
+		} else {
+			start = (void*) arena;
+			len = arena->length;
+		}
+	}
+
+	size_t migrate(int dst, const std::function<void(size_t, size_t)> &progress) {
+		static constexpr size_t BATCH_SIZE = (size_t)64 << 20;
 
-		// acquire all locks
+		// new mappings go to dst from now on. Arenas are never unmapped, and
+		// the ones created from now on are on dst, so the list can be walked
+		// without the lock later on
 		SpinLock_lock(arena_lock);
 		SpinLock_lock(mmapped_chunk_lock);
+		SpinLock_lock(slab_lock);
+		node.store(dst, std::memory_order_release);
+		Arena *arenas = arena_list;
+		SlabSegment *segments = slab_segments;
+		size_t total = slab_count * SlabSegment::SIZE;
+		SpinLock_unlock(slab_lock);
+		SpinLock_lock(region_lock);
+		for (RegionChunk *curr = region_chunks; curr != nullptr; curr = curr->next)
+			total += curr->size;
+		SpinLock_unlock(region_lock);
+
+		for (Arena *curr = arenas; curr != nullptr; curr = curr->next) {
+			void *start;
+			size_t len;
+			arena_data_range(curr, start, len);
+			total += len;
+		}
+		for (MmapChunkFooter *curr = mmapped_chunk_head; curr != nullptr; curr = curr->next)
+			if (curr->node != dst && !curr->freed)
+				total += curr->size;
 
-		// iterate through all arenas, add arena spaces
-		// (this includes the main arena and the MemSource)
-		for (Arena *curr = active_arena; curr != nullptr; curr = curr->next) {
-			SpinLock_lock(curr->mspace_lock);
-
-			void *top_chunk;
-			size_t top_chunk_size;
+		SpinLock_unlock(mmapped_chunk_lock);
+		SpinLock_unlock(arena_lock);
 
-			mspace_get_top_chunk_extent(curr->msp, &top_chunk, &top_chunk_size);
-			add_pages_to_vector(pages, (void*)curr->msp, top_chunk);
+		size_t done = 0;
 
+		// move arenas in batches of contiguous ranges, without blocking allocations
+		for (Arena *curr = arenas; curr != nullptr; curr = curr->next) {
 			// page-out unused space - will be paged in at new home node on demand
-			intptr_t dn_start = ALIGN_UP((intptr_t) top_chunk + 64, MEM_PAGE_SIZE);
-			intptr_t dn_end = ALIGN_DOWN((intptr_t) top_chunk + top_chunk_size - 64, MEM_PAGE_SIZE);
-			madvise((void*) dn_start, dn_end - dn_start, MADV_DONTNEED);
+			curr->trim();
+
+			void *start;
+			size_t len;
+			arena_data_range(curr, start, len);
+			for (size_t ofs = 0; ofs < len; ofs += BATCH_SIZE) {
+				const size_t batch = std::min(BATCH_SIZE, len - ofs);
+				if (bindMemory((char*) start + ofs, batch, dst) != 0)
+					perror("MemSource::migrate(): mbind()");
+				registerMemory((char*) start + ofs, batch, this, dst);
+				done += batch;
+				if (progress) progress(done, total);
+			}
 		}
 
-		// add directly mmapped memory blocks
-		for (MmapChunkFooter *curr = mmapped_chunk_head; curr != nullptr; curr = curr->next) {
-			char *end = (char*)curr + curr->size;
-			add_pages_to_vector(pages, (void*)curr, (void*)end);
+		// slab segments are never unmapped either, one segment per batch
+		SpinLock_lock(slab_lock);
+		trim_slabs_locked();
+		SpinLock_unlock(slab_lock);
+		for (SlabSegment *curr = segments; curr != nullptr; curr = curr->next) {
+			if (bindMemory((void*) curr, SlabSegment::SIZE, dst) != 0)
+				perror("MemSource::migrate(): mbind()");
+			registerMemory((void*) curr, SlabSegment::SIZE, this, dst);
+			done += SlabSegment::SIZE;
+			if (progress) progress(done, total);
 		}
 
-		// call move_pages
-		std::vector<int> dst_vec(pages.size(), dst);
-		std::vector<int> status_vec(pages.size(), 0);
-		if (move_pages(0, pages.size(), &pages[0], &dst_vec[0], &status_vec[0], MPOL_MF_MOVE) != 0) {
-			perror("MemSource::migrate(): move_pages()");
-			fprintf(stderr, "MemSource::migrate(): pages/status = [\n\t");
-			for (size_t i = 0; i < pages.size(); i++) {
-				fprintf(stderr, "%p (%d)", pages[i], status_vec[i]);
-				if (i == pages.size()-1) fprintf(stderr, "\n]\n");
-				else if (i % 6 == 5) fprintf(stderr, "\n\t");
-			}
+		// region chunks are only unmapped with the msource. Ones mapped from
+		// now on are on dst
+		SpinLock_lock(region_lock);
+		RegionChunk *region_head = region_chunks;
+		SpinLock_unlock(region_lock);
+		for (RegionChunk *curr = region_head; curr != nullptr; curr = curr->next) {
+			if (bindMemory((void*) curr, curr->size, dst) != 0)
+				perror("MemSource::migrate(): mbind()");
+			registerRegionMemory((void*) curr, curr->size, this, dst);
+			done += curr->size;
+			if (progress) progress(std::min(done, total), total);
 		}
 
-		// release all locks
-		SpinLock_unlock(arena_lock);
+		// mmapped chunks may be freed concurrently. Each one is pinned while
+		// it is moved in batches, and the next one is pinned before letting
+		// go of it. Chunks mapped from now on are on dst
+		SpinLock_lock(mmapped_chunk_lock);
+		MmapChunkFooter *curr = pin_chunk_locked(mmapped_chunk_head, dst);
 		SpinLock_unlock(mmapped_chunk_lock);
-		for (Arena *curr = active_arena; curr != nullptr; curr = curr->next)
-			SpinLock_unlock(curr->mspace_lock);
+		while (curr != nullptr) {
+			for (size_t ofs = 0; ofs < curr->size; ofs += BATCH_SIZE) {
+				const size_t batch = std::min(BATCH_SIZE, curr->size - ofs);
+				if (bindMemory((char*) curr + ofs, batch, dst) != 0)
+					perror("MemSource::migrate(): mbind()");
+				registerMemory((char*) curr + ofs, batch, this, dst);
+				done += batch;
+				if (progress) progress(std::min(done, total), total);
+			}
+
+			SpinLock_lock(mmapped_chunk_lock);
+			curr->node = dst;
+			MmapChunkFooter *next = pin_chunk_locked(curr->next, dst);
+			const bool unused = unpin_chunk_locked(curr);
+			SpinLock_unlock(mmapped_chunk_lock);
+			if (unused)
+				unmap(curr, curr->size);
+			curr = next;
+		}
+
+		return done / page_size;
+	}
+
+	// map a region chunk with room for at least bytes. expects region_lock to be held
+	inline RegionChunk *map_region_chunk(size_t bytes, RegionChunk *next) {
+		const size_t sz = std::max(region_chunk_size,
+			(size_t)ALIGN_UP(bytes + RegionChunk::HEADER_SIZE(), page_size));
+		void *mem = map_data(sz);
+		if (mem == nullptr)
+			return nullptr;
+		// the node map_data() placed it on, migrate() may change in between
+		int where;
+		lookupMemory(mem, &where);
+		if (registerRegionMemory(mem, sz, this, where) != 0) {
+			unmap(mem, sz);
+			return nullptr;
+		}
+		grow_footprint(sz);
+		return new (mem) RegionChunk(sz, next);
+	}
+
+	// make the chunk after seen current, or a new one if it can't hold
+	// bytes. Returns false if out of memory
+	inline bool next_region_chunk(RegionChunk *seen, size_t bytes) {
+		SpinLock_lock(region_lock);
+
+		// another thread moved on already
+		if (region_current.load(std::memory_order_relaxed) != seen) {
+			SpinLock_unlock(region_lock);
+			return true;
+		}
+
+		// chunks too small for this block are used for the next ones
+		RegionChunk *next = (seen != nullptr) ? seen->next : region_chunks;
+		if (next == nullptr || next->size - RegionChunk::HEADER_SIZE() < bytes) {
+			next = map_region_chunk(bytes, next);
+			if (next != nullptr) {
+				if (seen != nullptr)
+					seen->next = next;
+				else
+					region_chunks = next;
+			}
+		}
+
+		if (next != nullptr)
+			region_current.store(next, std::memory_order_release);
+		SpinLock_unlock(region_lock);
+		return next != nullptr;
+	}
+
+	// bump a block from the current chunk. Its footer holds its size
+	inline void *alloc_region(size_t bytes, size_t align, bool *zeroed) {
+		static constexpr size_t FOOTER = ChunkFooter::DATA_OFFSET();
+
+		// keep the next block's footer aligned
+		bytes = ALIGN_UP(std::max(bytes, (size_t)1), FOOTER);
+
+		RegionChunk *chunk = region_current.load(std::memory_order_acquire);
+		while (true) {
+			if (chunk != nullptr) {
+				size_t top = chunk->top.load(std::memory_order_relaxed);
+				while (true) {
+					const size_t data = ALIGN_UP((uintptr_t)chunk + top + FOOTER, align)
+						- (uintptr_t)chunk;
+					if (data + bytes > chunk->size)
+						break;
+					if (chunk->top.compare_exchange_weak(top, data + bytes,
+							std::memory_order_relaxed)) {
+						void *result = cast<void>(chunk, data);
+						ChunkFooter *ch = ChunkFooter::FROM_POINTER(result);
+						ch->source = this;
+						ch->arena_tag = bytes;
+						if (zeroed != nullptr)
+							*zeroed = data >= chunk->high;
+						return result;
+					}
+				}
+			}
+
+			if (!next_region_chunk(chunk, bytes + align + FOOTER))
+				return nullptr;
+			chunk = region_current.load(std::memory_order_acquire);
+		}
+	}
+
+	// region blocks grow in place if they are the last one bumped
+	inline void *resize_region(void *p, ChunkFooter *ch, size_t bytes) {
+		bytes = ALIGN_UP(std::max(bytes, (size_t)1), ChunkFooter::DATA_OFFSET());
+		if (bytes <= ch->arena_tag)
+			return p;
+
+		RegionChunk *chunk = region_current.load(std::memory_order_acquire);
+		if (chunk == nullptr)
+			return nullptr;
+
+		size_t top = (uintptr_t)p + ch->arena_tag - (uintptr_t)chunk;
+		const size_t end = (uintptr_t)p + bytes - (uintptr_t)chunk;
+		if (top > chunk->size || end > chunk->size
+				|| !chunk->top.compare_exchange_strong(top, end, std::memory_order_relaxed))
+			return nullptr;
 
-		node = dst;
+		ch->arena_tag = bytes;
+		return p;
+	}
+
+	// rewind all region chunks. Returns the number of bytes they had handed out
+	size_t reset() {
+		if (!region)
+			return 0;
+
+		size_t result = 0;
+		SpinLock_lock(region_lock);
+		for (RegionChunk *chunk = region_chunks; chunk != nullptr; chunk = chunk->next) {
+			const size_t top = chunk->top.load(std::memory_order_relaxed);
+			result += top - RegionChunk::HEADER_SIZE();
+			chunk->high = std::max(chunk->high, top);
+			chunk->top.store(RegionChunk::HEADER_SIZE(), std::memory_order_relaxed);
+		}
+		region_current.store(region_chunks, std::memory_order_release);
+		SpinLock_unlock(region_lock);
+
+		trace::release(this);
+		return result;
+	}
+
+	// if given, zeroed is set to whether the block is known to be zero
+	inline void *alloc(size_t bytes, bool *zeroed = nullptr)
+	{
+		if (region)
+			return alloc_region(bytes, ChunkFooter::DATA_OFFSET(), zeroed);
+		if (bytes > SlabSegment::MAX_SIZE || SlabSegment::map() == nullptr)
+			return alloc_chunked(bytes, zeroed);
+
+		// slots have been used before, or are not worth tracking
+		if (zeroed != nullptr)
+			*zeroed = false;
+
+		ThreadCache *tc = nullptr;
+#if MEM_SOURCE_THREAD_CACHE
+		tc = get_thread_cache();
+#endif
+		const size_t cls = SlabSegment::class_of_request(bytes);
+		void *result = alloc_slot(cls, tc);
+		if (result == nullptr)
+			return nullptr;
+
+		bool shared;
+		thread_counters(shared, tc).count_alloc(bytes, SlabSegment::class_size(cls), shared);
+		add_block(tc);
 
-		return pages.size();
+		return result;
 	}
 
-	inline void *alloc(size_t bytes)
+	// allocate a block with footer
+	inline void *alloc_chunked(size_t bytes, bool *zeroed = nullptr)
 	{
 		void *result = nullptr;
+		size_t usable;
+		ThreadCache *tc = nullptr;
 
 		// Directly allocate system memory?
 		if (bytes >= mmap_threshold) {
-			size_t sz = bytes + MmapChunkFooter::DATA_OFFSET();
-			void *mem = callMmap(sz, node);
+			size_t sz = ALIGN_UP(bytes + MmapChunkFooter::DATA_OFFSET(), page_size);
+			void *mem = map_data(sz);
 			if (mem == nullptr) return nullptr;
 
 			// Init chunk header
 			MmapChunkFooter *chunk = static_cast<MmapChunkFooter*>(mem);
 			chunk->footer.source = this;
-			chunk->footer.arena = nullptr;
+			chunk->footer.set_arena(nullptr);
 			chunk->size = sz;
+			chunk->node = node;
+			chunk->pins = 0;
+			chunk->freed = false;
 
 			// Insert into msource's mmap chunk list
 			chunk->prev = nullptr;
@@ -582,43 +2428,56 @@ public:
 			}
 			mmapped_chunk_head = chunk;
 			SpinLock_unlock(mmapped_chunk_lock);
+			grow_footprint(sz);
 
 			// Finalize
 			result = chunk->TO_POINTER();
+			usable = sz;
+			if (zeroed != nullptr)
+				*zeroed = true;
 		}
 		else {
-			SpinLock_lock(arena_lock);
+			ChunkFooter *arena_chunk;
 
-			// see if the active arena that can satisfy the request
-			ChunkFooter *arena_chunk = active_arena->alloc(bytes);
-
-			// if not, see if another arena may qualify as the new active arena (TODO)
-
-			// if not, create new arena as active arena
-			if (arena_chunk == nullptr) {
-				Arena *arena = create_new_arena((size_t)(64 << 20));
-				if (arena != nullptr) {
-					arena_chunk = arena->alloc(bytes);
-				}
-			}
+			// cached chunks have been used before
+			if (zeroed != nullptr)
+				*zeroed = false;
 
-			SpinLock_unlock(arena_lock);
+#if MEM_SOURCE_THREAD_CACHE
+			if (bytes > SlabSegment::MAX_SIZE && bytes <= ThreadCache::MAX_SIZE
+					&& (tc = get_thread_cache()) != nullptr)
+				arena_chunk = alloc_cached(tc, ThreadCache::class_of_request(bytes));
+			else
+#endif
+			arena_chunk = alloc_chunk(bytes, zeroed);
 
 			if (arena_chunk == nullptr)
 				return nullptr;
 
 			result = arena_chunk->TO_POINTER();
+			const int cls = arena_chunk->cache_class();
+			usable = (cls >= 0) ? ThreadCache::class_size(cls)
+				: dlmalloc_usable_size((void*)arena_chunk) - ChunkFooter::DATA_OFFSET();
 		}
 
-		blocks.addBlock();
+		bool shared;
+		thread_counters(shared, tc).count_alloc(bytes, usable, shared);
+		add_block(tc);
 
 		return result;
 	}
 
 	inline void *alloc_align(size_t align, size_t sz) {
-		// alloc larger size - to make room for alignment and fake footer
+		// alloc larger size - to make room for alignment and fake footer.
+		// The fake footer needs a real one behind it, so slots don't do
+		if (align <= (size_t)ChunkFooter::DATA_OFFSET())
+			return alloc(sz);
+		if (region)
+			return alloc_region(sz, align, nullptr);
 		size_t alloc_size = sz + align + ChunkFooter::DATA_OFFSET();
-		void *p = alloc(alloc_size);
+		void *p = alloc_chunked(alloc_size);
+		if (p == nullptr)
+			return nullptr;
 
 		intptr_t pint = (intptr_t) p;
 
@@ -637,11 +2496,29 @@ public:
 		return fake_chunk->TO_POINTER();
 	}
 
+	// region blocks are only discarded all at once, and don't keep their
+	// region alive. Once a region is destroyed, the footers of its blocks
+	// are gone with it, and the address map's region mark tells the blocks
+	// apart instead. Until then, processes don't pay for the lookup
+	static inline bool is_gone_region_block(const void *p) {
+		return s_regions_destroyed.load(std::memory_order_acquire) && isRegionMemory(p);
+	}
+
 	static inline void free(void *p)
 	{
 		if (p != nullptr) {
+			if (SlabSegment *seg = SlabSegment::of(p)) {
+				if (seg->source->free_slot(p, seg->span_of(p)->cls))
+					destroy(seg->source);
+				return;
+			}
+			if (is_gone_region_block(p))
+				return;
+
 			ChunkFooter *ch = get_footer_for_mem(p);
 			MemSourceImpl *src = ch->source;
+			if (src->region)
+				return;
 
 			// if this was the last chunk allocated, and the msource is already
 			// abandoned, destroy the msource now
@@ -651,54 +2528,361 @@ public:
 		}
 	}
 
-	static inline int physicalNodeOf(void *p) {
-		if (p == nullptr) return -1;
-		ChunkFooter *ch = get_footer_for_mem(p);
-		return ch->source->get_node();
+	// like free(), for blocks without an alignment offset, given the size
+	// they were allocated or last resized with. Only that small blocks may
+	// be slots, whose class follows from the size, so the span's header is
+	// not read. Other blocks have their footer directly in front of them
+	static inline void free_sized(void *p, size_t sz)
+	{
+		if (p != nullptr) {
+			SlabSegment *seg = (sz <= SlabSegment::MAX_SIZE) ? SlabSegment::of(p) : nullptr;
+			if (seg != nullptr) {
+				const size_t cls = SlabSegment::class_of_request(sz);
+				assert(cls == seg->span_of(p)->cls);
+				if (seg->source->free_slot(p, cls))
+					destroy(seg->source);
+				return;
+			}
+
+			if (is_gone_region_block(p))
+				return;
+			assert(sz <= get_block_size(p));
+
+			ChunkFooter *ch = ChunkFooter::FROM_POINTER(p);
+			MemSourceImpl *src = ch->source;
+			assert(src != nullptr);
+			if (src->region)
+				return;
+
+			if (src->free_impl(p, ch)) {
+				destroy(src);
+			}
+		}
+	}
+
+	// every block is aligned like the chunk data, blocks with larger
+	// alignment may have been shifted behind a fake footer
+	static inline bool has_footer_in_front(size_t align) {
+		return align <= (size_t)ChunkFooter::DATA_OFFSET();
+	}
+
+	// node of the memory at p, which may point into the middle of a block.
+	// -1 for memory of no msource
+	static inline int physicalNodeOf(const void *p) {
+		int node;
+		MemSourceImpl *src = static_cast<MemSourceImpl*>(lookupMemory(p, &node));
+		if (src != nullptr && node < 0 && src->interleave.count > 0)
+			return getNumaNodeForMemory(p);
+		return node;
 	}
 
+	static void physicalNodesOf(const void **ptrs, size_t count, int *nodes) {
+		static constexpr size_t BATCH = 64;
+		void *owners[BATCH];
+
+		for (size_t i = 0; i < count; i += BATCH) {
+			const size_t n = std::min(BATCH, count - i);
+			lookupMemory_n(n, ptrs + i, owners, nodes + i);
+			for (size_t j = 0; j < n; j++) {
+				MemSourceImpl *src = static_cast<MemSourceImpl*>(owners[j]);
+				if (src != nullptr && nodes[i+j] < 0 && src->interleave.count > 0)
+					nodes[i+j] = getNumaNodeForMemory(ptrs[i+j]);
+			}
+		}
+	}
+
+	// reads counters and lists, taking each lock only briefly
 	struct msource_info stats()
 	{
 		struct msource_info result;
+		memset(&result, 0, sizeof(result));
 
-		result.arena_count = 0;
-		result.arena_used = 0;
-		result.arena_size = 0;
-		result.hugeobj_count = 0;
-		result.hugeobj_used = 0;
-		result.hugeobj_size = 0;
+		const int where = node.load(std::memory_order_acquire);
+		result.node_count = (where >= 0) ? 1 : interleave.count;
 
 		Arena *arena;
 		MmapChunkFooter *mch;
 
 		// count every mspace arena - this includes the actual msource struct
-		// (native arena)
-		for (arena = active_arena; arena; arena = arena->next) {
-			intptr_t base = ALIGN_DOWN((intptr_t)arena, MEM_PAGE_SIZE);
-			intptr_t end = (intptr_t)arena + arena->alloc_end;
-
-			struct mallinfo minfo = mspace_mallinfo(arena->msp);
-
-			result.arena_used += ALIGN_UP(end-base, MEM_PAGE_SIZE);
-			result.arena_size += minfo.uordblks;
+		// (native arena). Arenas are only prepended, never removed
+		SpinLock_lock(arena_lock);
+		Arena *arena_head = arena_list;
+		SpinLock_unlock(arena_lock);
+		for (arena = arena_head; arena; arena = arena->next) {
+			SpinLock_lock(arena->mspace_lock);
+			const size_t alloc_end = arena->alloc_end;
+			const size_t released = arena->released;
+			SpinLock_unlock(arena->mspace_lock);
+
+			intptr_t base = ALIGN_DOWN(arena->native ? (intptr_t)arena : (intptr_t)arena->base,
+				page_size);
+			intptr_t end = (intptr_t)arena->base + alloc_end;
+
+			result.arena_used += ALIGN_UP(end-base, page_size);
+			result.arena_size += arena->in_use.load(std::memory_order_relaxed);
+			result.arena_released += released;
 			result.arena_count += 1;
 		}
 
 		// count mmapped chunks
+		SpinLock_lock(mmapped_chunk_lock);
 		for (mch = mmapped_chunk_head; mch; mch = mch->next) {
-			result.hugeobj_used += ALIGN_UP(mch->size, MEM_PAGE_SIZE);
+			if (mch->freed)
+				continue;
+			result.hugeobj_used += ALIGN_UP(mch->size, page_size);
 			result.hugeobj_size += mch->size;
 			result.hugeobj_count += 1;
 		}
+		SpinLock_unlock(mmapped_chunk_lock);
+
+		// count slab spans in use, and their handed out slots
+		SpinLock_lock(slab_lock);
+		for (SlabSegment *seg = slab_segments; seg != nullptr; seg = seg->next) {
+			for (size_t i = 1; i < SlabSegment::SPAN_COUNT; i++) {
+				const SlabSegment::Span &span = seg->spans[i];
+				if (span.cls == SlabSegment::NO_CLASS)
+					continue;
+				result.slab_used += SlabSegment::SPAN_SIZE;
+				result.slab_size += span.used * SlabSegment::class_size(span.cls);
+			}
+			result.slab_count += 1;
+		}
+		result.slab_released = slab_released;
+		SpinLock_unlock(slab_lock);
+
+		// count region chunks, and the bytes bumped from them
+		SpinLock_lock(region_lock);
+		for (RegionChunk *chunk = region_chunks; chunk != nullptr; chunk = chunk->next) {
+			result.region_used += chunk->size;
+			result.region_size += chunk->top.load(std::memory_order_relaxed) - RegionChunk::HEADER_SIZE();
+			result.region_count += 1;
+		}
+		SpinLock_unlock(region_lock);
+
+		shared_counters.add_to(result);
+#if MEM_SOURCE_THREAD_CACHE
+		for (std::atomic<ThreadCache*> &slot : thread_caches)
+			if (ThreadCache *tc = slot.load(std::memory_order_acquire))
+				tc->counters.add_to(result);
+#endif
+		result.peak_bytes = footprint_peak.load(std::memory_order_relaxed);
+
+		return result;
+	}
+
+	// memory to be faulted in by prefault()
+	struct PrefaultRange
+	{
+		void                   *start;
+		size_t                  len;
+	};
+
+	// pieces of prefault ranges, taken by several threads
+	struct PopulateJob
+	{
+		static constexpr size_t PIECE_SIZE = (size_t)64 << 20;
+
+		std::vector<PrefaultRange> pieces;
+		std::atomic_size_t      next;
+		size_t                  page_size;
+
+		void run() {
+			for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < pieces.size(); )
+				populateMemory(pieces[i].start, pieces[i].len, page_size);
+		}
+
+		static void *run_thread(void *job) {
+			static_cast<PopulateJob*>(job)->run();
+			return nullptr;
+		}
+	};
+
+	// fault in the given ranges. Large ones are split into pieces, which
+	// threads pinned to the msource's node fault in along with the caller.
+	// Returns the number of bytes
+	size_t populate(const std::vector<PrefaultRange> &ranges) const {
+		PopulateJob job;
+		job.next = 0;
+		job.page_size = page_size;
+
+		const size_t piece = ALIGN_UP(PopulateJob::PIECE_SIZE, page_size);
+		size_t result = 0;
+		for (const PrefaultRange &range : ranges) {
+			for (size_t ofs = 0; ofs < range.len; ofs += piece)
+				job.pieces.push_back(PrefaultRange { (char*) range.start + ofs,
+					std::min(piece, range.len - ofs) });
+			result += range.len;
+		}
+
+		// one thread per CPU of the node, or of the machine if the memory is
+		// not on a single node
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		size_t cpu_count = 0;
+		const int logical_node = (node >= 0) ? NodeList::physicalToLogicalId(node) : -1;
+		if (logical_node >= 0) {
+			for (const CpuId cpu : NodeList::logicalNodes()[logical_node].cpuids()) {
+				CPU_SET(cpu, &cpus);
+				cpu_count++;
+			}
+		} else {
+			cpu_count = (size_t) std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+		}
+
+		std::vector<pthread_t> threads;
+		const size_t thread_count = std::min(cpu_count, job.pieces.size());
+		for (size_t i = 1; i < thread_count; i++) {
+			pthread_attr_t attr;
+			pthread_t thread;
+			pthread_attr_init(&attr);
+			if (logical_node >= 0)
+				pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+			if (pthread_create(&thread, &attr, PopulateJob::run_thread, &job) == 0)
+				threads.push_back(thread);
+			pthread_attr_destroy(&attr);
+		}
+
+		job.run();
+		for (pthread_t thread : threads)
+			pthread_join(thread, nullptr);
 
 		return result;
 	}
 
+	// fault in up to bytes of the msource's memory: its arenas, then its
+	// mmapped chunks, then a new arena for the rest, which allocations move
+	// on to once the others are exhausted. Returns the number of bytes
 	size_t prefault(size_t bytes) {
-		return native_arena->prefault(bytes);
+		if (region)
+			return prefault_region(bytes);
+
+		std::vector<PrefaultRange> ranges;
+		size_t planned = 0;
+
+		// arenas are never removed, so they can be faulted in without the lock
+		SpinLock_lock(arena_lock);
+		Arena *arenas = arena_list;
+		SpinLock_unlock(arena_lock);
+		for (Arena *curr = arenas; curr != nullptr && planned < bytes; curr = curr->next) {
+			const size_t len = std::min(bytes - planned, curr->size);
+			ranges.push_back(PrefaultRange { curr->base, len });
+			planned += len;
+		}
+
+		// mmapped chunks may be freed meanwhile, they are pinned until they
+		// are done, so they are faulted in without the lock
+		std::vector<MmapChunkFooter*> pinned;
+		SpinLock_lock(mmapped_chunk_lock);
+		for (MmapChunkFooter *curr = mmapped_chunk_head; planned < bytes
+				&& (curr = pin_chunk_locked(curr)) != nullptr; curr = curr->next) {
+			const size_t len = std::min(bytes - planned, curr->size);
+			ranges.push_back(PrefaultRange { (void*) curr, len });
+			pinned.push_back(curr);
+			planned += len;
+		}
+		SpinLock_unlock(mmapped_chunk_lock);
+
+		if (planned < bytes) {
+			SpinLock_lock(arena_lock);
+			Arena *arena = create_new_arena(bytes - planned + page_size);
+			SpinLock_unlock(arena_lock);
+			if (arena != nullptr)
+				ranges.push_back(PrefaultRange { arena->base, std::min(bytes - planned, arena->size) });
+		}
+
+		const size_t result = populate(ranges);
+
+		// unmap the chunks freed meanwhile
+		size_t unused = 0;
+		SpinLock_lock(mmapped_chunk_lock);
+		for (MmapChunkFooter *curr : pinned)
+			if (unpin_chunk_locked(curr))
+				pinned[unused++] = curr;
+		SpinLock_unlock(mmapped_chunk_lock);
+		for (size_t i = 0; i < unused; i++)
+			unmap(pinned[i], pinned[i]->size);
+
+		return result;
+	}
+
+	// fault in region chunks in the order they are used, mapping more if needed
+	size_t prefault_region(size_t bytes) {
+		std::vector<PrefaultRange> ranges;
+		size_t planned = 0;
+
+		SpinLock_lock(region_lock);
+		RegionChunk **link = &region_chunks;
+		while (planned < bytes) {
+			if (*link == nullptr && (*link = map_region_chunk(0, nullptr)) == nullptr)
+				break;
+			const size_t len = std::min(bytes - planned, (*link)->size);
+			ranges.push_back(PrefaultRange { (void*) *link, len });
+			planned += len;
+			link = &(*link)->next;
+		}
+		if (region_current.load(std::memory_order_relaxed) == nullptr)
+			region_current.store(region_chunks, std::memory_order_release);
+		SpinLock_unlock(region_lock);
+
+		// chunks are only unmapped along with the msource
+		return populate(ranges);
+	}
+
+	// release the pages of unused slab spans, unless huge pages back them.
+	// expects slab_lock to be held
+	inline size_t trim_slabs_locked() {
+		if (page_size > SlabSegment::SPAN_SIZE)
+			return 0;
+
+		drain_remote_slots_locked();
+		size_t result = 0;
+		for (SlabSegment::Span *span = slab_unused; span != nullptr; span = span->next) {
+			if (span->released)
+				continue;
+			SlabSegment *seg = segment_of(span);
+			if (madvise(seg->span_data(span), SlabSegment::SPAN_SIZE, MADV_DONTNEED) == 0) {
+				span->released = true;
+				result += SlabSegment::SPAN_SIZE;
+			}
+		}
+		slab_released += result;
+		return result;
+	}
+
+	size_t trim() {
+		size_t result = 0;
+
+		SpinLock_lock(arena_lock);
+		for (Arena *curr = arena_list; curr != nullptr; curr = curr->next)
+			result += curr->trim();
+		SpinLock_unlock(arena_lock);
+
+		SpinLock_lock(slab_lock);
+		result += trim_slabs_locked();
+		SpinLock_unlock(slab_lock);
+
+		// release the pages of region chunks not used since the last reset
+		SpinLock_lock(region_lock);
+		RegionChunk *current = region_current.load(std::memory_order_relaxed);
+		for (RegionChunk *chunk = (current != nullptr) ? current->next : nullptr;
+				chunk != nullptr; chunk = chunk->next) {
+			const size_t start = ALIGN_UP(RegionChunk::HEADER_SIZE(), page_size);
+			if (chunk->high <= start || chunk->size <= start)
+				continue;
+			if (madvise((char*) chunk + start, chunk->size - start, MADV_DONTNEED) == 0) {
+				result += chunk->high - start;
+				chunk->high = start;
+			}
+		}
+		SpinLock_unlock(region_lock);
+
+		return result;
 	}
 };
 
+constexpr size_t MemSourceImpl::Interleave::MAX_NODES;
+constexpr size_t MemSourceImpl::Interleave::GRANULE;
+
 } // namespace msource
 
 MemSource::MemSource() : _msource(nullptr) {}
@@ -745,12 +2929,35 @@ MemSource& MemSource::operator=(MemSource &&other) {
 	return *this;
 }
 
-MemSource MemSource::create(int phys_node, size_t sz, const char *str, int phys_home_node) {
-	msource::MemSourceImpl *impl = msource::MemSourceImpl::create(phys_node, sz, str, phys_home_node);
+MemSource MemSource::create(int phys_node, size_t sz, const char *str, int phys_home_node,
+		PageSize pages) {
+	msource::MemSourceImpl *impl = msource::MemSourceImpl::create(phys_node, sz, str, phys_home_node, pages);
 	numa::debug::log(numa::debug::DEBUG, "Created MemSource \"%s\" on node %d", str, phys_node);
 	return MemSource(impl);
 }
 
+MemSource MemSource::createRegion(int phys_node, size_t chunk_sz, const char *str, PageSize pages) {
+	msource::MemSourceImpl *impl = msource::MemSourceImpl::create_region(phys_node, chunk_sz, str, pages);
+	numa::debug::log(numa::debug::DEBUG, "Created region MemSource \"%s\" on node %d", str, phys_node);
+	return MemSource(impl);
+}
+
+MemSource MemSource::createInterleaved(const NodeList &nodes, size_t sz, const char *str,
+		const std::vector<size_t> &weights, PageSize pages) {
+	assert(!nodes.empty());
+	assert(weights.empty() || weights.size() == nodes.size());
+
+	std::vector<int> phys_nodes;
+	for (const Node &n : nodes)
+		phys_nodes.push_back(n.physicalId());
+
+	msource::MemSourceImpl *impl = msource::MemSourceImpl::create_interleaved(phys_nodes.data(),
+		weights.empty() ? nullptr : weights.data(), phys_nodes.size(), sz, str, pages);
+	numa::debug::log(numa::debug::DEBUG, "Created MemSource \"%s\" interleaved on %zu nodes",
+		str, phys_nodes.size());
+	return MemSource(impl);
+}
+
 const MemSource& MemSource::global() {
 	static MemSource                global_msource;
 	static numa::SpinLock           global_msource_mutex;
@@ -759,7 +2966,8 @@ const MemSource& MemSource::global() {
 	{
 		std::lock_guard<numa::SpinLock> lock(global_msource_mutex);
 		if (!(valid = global_msource.valid()))
-			global_msource = MemSource(msource::MemSourceImpl::create(-1, 1LL<<24, "global", -1));
+			global_msource = MemSource(msource::MemSourceImpl::create(-1,
+				defaultGrowth().min_arena, "global", -1));
 	}
 
 	if (!valid)
@@ -769,80 +2977,178 @@ const MemSource& MemSource::global() {
 }
 
 const MemSource& MemSource::forNode(const size_t phys_node) {
-	static msource::MemSourceImpl **global_msource_impls = nullptr;
-	static msvector<MemSource>      global_msource_ptrs(global());
+	// Immutable table of node-global msources, indexed by physical node ID.
+	// It is filled completely before being published, so readers don't lock.
+	// IDs in gaps of the topology get a source on demand, in a second table
+	// that is protected by the mutex
+	static std::atomic<const MemSource*> global_msource_table(nullptr);
+	static MemSource               *global_msource_gaps = nullptr;
 	static size_t                   global_msources_max_id = 0;
 	static numa::SpinLock           global_msources_mutex;
 
-	std::lock_guard<numa::SpinLock> lock(global_msources_mutex);
-
-	/**
-	Note that "maxNodeID + 1 != nodeCount" on some systems.
-	We allocate global_msource_ptrs and global_msource_impls based on
-	maxNodeID, so that the physical ID can always be used as index.
-	Accepting that there can be gaps in the arrays/vectors, wasting a few bytes
-	of memory.
-	*/
-
-	if (global_msource_impls == nullptr) {
-		global_msources_max_id = numa::util::Topology::get()->node_ids().back();
-		const size_t sz = sizeof(msource::MemSourceImpl*) * (global_msources_max_id + 1);
-
-		global_msource_impls = (msource::MemSourceImpl**) global().allocAligned(64, sz);
-		for (size_t i = 0; i <= global_msources_max_id; i++)
-			global_msource_impls[i] = nullptr;
+	const MemSource *table = global_msource_table.load(std::memory_order_acquire);
+
+	if (table == nullptr) {
+		std::lock_guard<numa::SpinLock> lock(global_msources_mutex);
+		table = global_msource_table.load(std::memory_order_relaxed);
+
+		/**
+		Note that "maxNodeID + 1 != nodeCount" on some systems.
+		We allocate the table based on maxNodeID, so that the physical ID can
+		always be used as index. Accepting that there can be gaps in the table,
+		wasting a few bytes of memory.
+		*/
+
+		if (table == nullptr) {
+			const std::vector<int> &node_ids = numa::util::Topology::get()->node_ids();
+			const size_t max_id = node_ids.back();
+			const size_t sz = sizeof(MemSource) * (max_id + 1);
+
+			// never freed, references to the msources stay valid until exit
+			MemSource *sources = (MemSource*) global().allocAligned(64, 2 * sz);
+			for (size_t i = 0; i <= 2 * max_id + 1; i++)
+				new (&sources[i]) MemSource();
+			global_msource_gaps = sources + max_id + 1;
+
+			for (const int id : node_ids) {
+				char buff[4096];
+				snprintf(buff, sizeof(buff) / sizeof(buff[0]), "node_global(%d)", id);
+				sources[id] = MemSource(msource::MemSourceImpl::create(id,
+					defaultGrowth().min_arena, buff, -1));
+
+				numa::debug::log(numa::debug::DEBUG, "Created nodeGlobal MemSource (%d)", id);
+			}
 
-		global_msource_ptrs.resize(global_msources_max_id + 1);
+			global_msources_max_id = max_id;
+			global_msource_table.store(sources, std::memory_order_release);
+			table = sources;
+		}
 	}
 
+	// malloc() gets here as well, so don't throw for unknown nodes
 	assert(phys_node <= global_msources_max_id);
+	if (phys_node > global_msources_max_id) {
+		static const MemSource invalid;
+		return invalid;
+	}
 
-	if (global_msource_impls[phys_node] == nullptr) {
+	if (table[phys_node].valid())
+		return table[phys_node];
+
+	std::lock_guard<numa::SpinLock> lock(global_msources_mutex);
+	MemSource &gap = global_msource_gaps[phys_node];
+	if (!gap.valid()) {
 		char buff[4096];
 		snprintf(buff, sizeof(buff) / sizeof(buff[0]), "node_global(%zu)", phys_node);
-		global_msource_impls[phys_node] = msource::MemSourceImpl::create(phys_node, 1LL<<24, buff, -1);
-		global_msource_ptrs[phys_node] = MemSource(global_msource_impls[phys_node]);
+		gap = MemSource(msource::MemSourceImpl::create(phys_node,
+			defaultGrowth().min_arena, buff, -1));
 
 		numa::debug::log(numa::debug::DEBUG, "Created nodeGlobal MemSource (%zu)", phys_node);
 	}
+	return gap;
+}
 
-	return global_msource_ptrs[phys_node];
+// sampled allocation tracing, see MemSource::setTraceSampling()
+static inline void trace_alloc(msource::MemSourceImpl *ms, void *p, size_t sz) {
+	if (msource::trace::should_sample(sz))
+		msource::trace::record_alloc(ms, p, sz, msource::curr_thread_node());
 }
 
-void* MemSource::alloc(size_t sz) const {
+static inline bool tracing_blocks() {
+	return msource::trace::live_samples.load(std::memory_order_relaxed) != 0;
+}
+
+void* MemSourceRef::alloc(size_t sz) const {
 	void *ret = _msource->alloc(sz);
+	trace_alloc(_msource, ret, sz);
 #if MEM_SOURCE_FILL_MEMORY_DEBUG
 	memset(ret, 0xAA, (sz+7) & ~(ssize_t)7);
 #endif
 	return ret;
 }
 
-void* MemSource::allocAligned(size_t align, size_t sz) const {
+void* MemSourceRef::allocZeroed(size_t sz) const {
+	bool zeroed;
+	void *ret = _msource->alloc(sz, &zeroed);
+	if (ret != nullptr && !zeroed)
+		memset(ret, 0, sz);
+	trace_alloc(_msource, ret, sz);
+	return ret;
+}
+
+void* MemSourceRef::allocAligned(size_t align, size_t sz) const {
 	void *ret = _msource->alloc_align(align, sz);
+	trace_alloc(_msource, ret, sz);
 #if MEM_SOURCE_FILL_MEMORY_DEBUG
 	memset(ret, 0xAA, (sz+7) & ~(ssize_t)7);
 #endif
 	return ret;
 }
 
+void* MemSource::alloc(size_t sz) const {
+	return MemSourceRef(*this).alloc(sz);
+}
+
+void* MemSource::allocZeroed(size_t sz) const {
+	return MemSourceRef(*this).allocZeroed(sz);
+}
+
+void* MemSource::allocAligned(size_t align, size_t sz) const {
+	return MemSourceRef(*this).allocAligned(align, sz);
+}
+
 void MemSource::free(void *p) {
 	if (p == nullptr) return;
 #if MEM_SOURCE_FILL_MEMORY_DEBUG
 	memset(p, 0xBB, allocatedSize(p));
 #endif
+	if (tracing_blocks())
+		msource::trace::record_free(p);
 	msource::MemSourceImpl::free(p);
 }
 
+void MemSource::freeSized(void *p, size_t sz) {
+	if (p == nullptr) return;
+#if MEM_SOURCE_FILL_MEMORY_DEBUG
+	memset(p, 0xBB, allocatedSize(p));
+#endif
+	if (tracing_blocks())
+		msource::trace::record_free(p);
+	msource::MemSourceImpl::free_sized(p, sz);
+}
+
+void MemSource::freeAlignedSized(void *p, size_t align, size_t sz) {
+	if (msource::MemSourceImpl::has_footer_in_front(align))
+		freeSized(p, sz);
+	else
+		free(p);
+}
+
 size_t MemSource::allocatedSize(void *p) {
 	return msource::MemSourceImpl::get_block_size(p);
 }
 
+void* MemSource::resize(void *p, size_t sz) {
+	void *ret = msource::MemSourceImpl::resize(p, sz);
+	if (ret != nullptr && tracing_blocks())
+		msource::trace::record_resize(p, ret, sz);
+	return ret;
+}
+
 int MemSource::getPhysicalNode() const {
 	return _msource->get_node();
 }
 
+PageSize MemSource::getPageSize() const {
+	return _msource->get_page_size();
+}
+
 size_t MemSource::migrate(int phys_node) const {
-	return _msource->migrate(phys_node);
+	return _msource->migrate(phys_node, MigrateProgress());
+}
+
+size_t MemSource::migrate(int phys_node, const MigrateProgress &progress) const {
+	return _msource->migrate(phys_node, progress);
 }
 
 Node MemSource::getNodeOf(void *p) {
@@ -855,6 +3161,17 @@ Node MemSource::getNodeOf(void *p) {
 	return all[static_cast<size_t>(logicalId)];
 }
 
+void MemSource::getNodesOf(const void **ptrs, size_t count, Node *nodes) {
+	std::vector<int> physicalIds(count);
+	numa::msource::MemSourceImpl::physicalNodesOf(ptrs, count, physicalIds.data());
+
+	const NodeList& all = NodeList::logicalNodes();
+	for (size_t i = 0; i < count; i++) {
+		const int logicalId = NodeList::physicalToLogicalId(physicalIds[i]);
+		nodes[i] = (logicalId < 0) ? Node() : all[static_cast<size_t>(logicalId)];
+	}
+}
+
 Node MemSource::getLogicalNode() const {
 	const int physicalId = _msource->get_node();
 	const int logicalId = NodeList::physicalToLogicalId(physicalId);
@@ -875,10 +3192,48 @@ struct msource_info MemSource::stats() const {
 	return _msource->stats();
 }
 
+std::vector<msource_snapshot> MemSource::snapshotAll() {
+	return msource::MemSourceImpl::snapshot_all();
+}
+
 size_t MemSource::prefault(size_t bytes) {
 	return _msource->prefault(bytes);
 }
 
+size_t MemSource::trim() const {
+	return _msource->trim();
+}
+
+const msource_growth& MemSource::defaultGrowth() {
+	return msource::MemSourceImpl::default_growth();
+}
+
+msource_growth MemSource::getGrowth() const {
+	return _msource->get_growth();
+}
+
+void MemSource::setGrowth(const msource_growth &growth) const {
+	_msource->set_growth(growth);
+}
+
+size_t MemSource::reset() const {
+	return _msource->reset();
+}
+
+void MemSource::setTraceSampling(size_t sample_bytes) {
+	msource::trace::set_rate(sample_bytes);
+}
+
+std::vector<msource_trace_site> MemSource::traceSites() const {
+	return msource::trace::sites(_msource);
+}
+
+size_t MemSource::traceReport(FILE *out) const {
+	char buff[4096];
+	_msource->getDescription(buff, 4096);
+	return msource::trace::report(_msource, buff, false, out);
+}
+
 }
 
 /*
@@ -0,0 +1,473 @@
+#include "msource/msource_trace.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unwind.h>
+
+#include "PGASUS/base/spinlock.hpp"
+#include "PGASUS/msource/mmaphelper.h"
+
+namespace numa {
+
+constexpr size_t msource_trace_site::MAX_FRAMES;
+
+namespace msource {
+namespace trace {
+
+std::atomic<size_t> live_samples(0);
+thread_local ssize_t countdown __attribute__((tls_model("initial-exec"))) = 0;
+
+namespace {
+
+static constexpr size_t MAX_FRAMES = msource_trace_site::MAX_FRAMES;
+
+// fixed table sizes, further samples are dropped
+static constexpr size_t LIVE_CAPACITY = 1 << 16;
+static constexpr size_t SITE_CAPACITY = 1 << 12;
+
+// bytes between two looks at the rate, while sampling is disabled
+static constexpr ssize_t DISABLED_RECHECK = 1 << 20;
+
+// rate not yet read from the environment
+static constexpr ssize_t UNSET = -1;
+
+// marks a site entry of a destroyed source, which can be reused
+static const void * const TOMBSTONE = &TOMBSTONE;
+
+struct Site
+{
+	const void *owner;       // nullptr if unused
+	uint64_t hash;
+	msource_trace_site info;
+};
+
+struct Sample
+{
+	void *ptr;               // nullptr if unused
+	size_t weight;           // estimated bytes the sample stands for
+	size_t site;
+};
+
+std::atomic<ssize_t> s_rate(UNSET);
+
+// per-thread sampling state. While the tracer runs, nested allocations (e.g.
+// from the unwinder or from building result vectors) are neither sampled nor
+// recorded
+thread_local uint64_t s_random __attribute__((tls_model("initial-exec"))) = 0;
+thread_local bool s_busy __attribute__((tls_model("initial-exec"))) = false;
+
+// whether countdown has been drawn from the sampling rate. It is not for a
+// thread's first allocation, and while sampling is disabled
+thread_local bool s_armed __attribute__((tls_model("initial-exec"))) = false;
+
+// the tables, mapped on the first sample and never returned
+numa::SpinLock s_lock;
+Sample *s_live = nullptr;
+Site *s_sites = nullptr;
+size_t s_live_used = 0;
+size_t s_sites_used = 0;   // including tombstones
+
+// sampled blocks by home slot in s_live, so that most frees skip the lock
+std::atomic<uint16_t> s_live_filter[LIVE_CAPACITY];
+
+struct Busy
+{
+	Busy() { s_busy = true; }
+	~Busy() { s_busy = false; }
+};
+
+static inline uint64_t mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static inline uint64_t next_random() {
+	if (s_random == 0)
+		s_random = mix((uintptr_t)&s_random) | 1;
+
+	// xorshift64*
+	s_random ^= s_random >> 12;
+	s_random ^= s_random << 25;
+	s_random ^= s_random >> 27;
+	return s_random * 0x2545f4914f6cdd1dULL;
+}
+
+static ssize_t init_rate() {
+	const char *str = getenv("NUMA_TRACE_SAMPLE");
+	const unsigned long long bytes = (str != nullptr) ? strtoull(str, nullptr, 0) : 0;
+
+	ssize_t expected = UNSET;
+	s_rate.compare_exchange_strong(expected,
+		(ssize_t)std::min(bytes, (unsigned long long)(SSIZE_MAX / 2)));
+	return s_rate.load();
+}
+
+static inline ssize_t load_rate() {
+	const ssize_t r = s_rate.load(std::memory_order_relaxed);
+	return (r == UNSET) ? init_rate() : r;
+}
+
+struct Unwind
+{
+	void **frames;
+	size_t count;
+	size_t skip;
+};
+
+static _Unwind_Reason_Code unwind_frame(struct _Unwind_Context *ctx, void *arg) {
+	Unwind *u = static_cast<Unwind*>(arg);
+	void *ip = (void*) _Unwind_GetIP(ctx);
+	if (ip == nullptr)
+		return _URC_END_OF_STACK;
+
+	if (u->skip > 0) {
+		u->skip--;
+		return _URC_NO_REASON;
+	}
+
+	u->frames[u->count++] = ip;
+	return (u->count < MAX_FRAMES) ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+// return addresses of the caller's callers
+static __attribute__((noinline)) size_t capture(void **frames) {
+	Unwind u = { frames, 0, 2 };
+	_Unwind_Backtrace(unwind_frame, &u);
+	return u.count;
+}
+
+static bool map_tables() {
+	if (s_sites != nullptr)
+		return true;
+
+	void *live = mmap(0, LIVE_CAPACITY * sizeof(Sample), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	void *sites = mmap(0, SITE_CAPACITY * sizeof(Site), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (live == MAP_FAILED || sites == MAP_FAILED) {
+		if (live != MAP_FAILED) munmap(live, LIVE_CAPACITY * sizeof(Sample));
+		if (sites != MAP_FAILED) munmap(sites, SITE_CAPACITY * sizeof(Site));
+		return false;
+	}
+
+	s_live = static_cast<Sample*>(live);
+	s_sites = static_cast<Site*>(sites);
+	return true;
+}
+
+// site of owner with the given call stack, created if needed. Requires s_lock
+static Site *find_site(const void *owner, uint64_t hash, void * const *frames, size_t count) {
+	Site *reuse = nullptr;
+	for (size_t i = hash % SITE_CAPACITY; s_sites[i].owner != nullptr; i = (i + 1) % SITE_CAPACITY) {
+		Site &s = s_sites[i];
+		if (s.owner == TOMBSTONE) {
+			if (reuse == nullptr)
+				reuse = &s;
+		} else if (s.owner == owner && s.hash == hash && s.info.frame_count == count
+				&& std::equal(frames, frames + count, s.info.frames)) {
+			return &s;
+		}
+	}
+
+	if (reuse == nullptr) {
+		// keep probe sequences short
+		if (4 * (s_sites_used + 1) > 3 * SITE_CAPACITY)
+			return nullptr;
+		reuse = &s_sites[hash % SITE_CAPACITY];
+		while (reuse->owner != nullptr)
+			reuse = &s_sites[(reuse - s_sites + 1) % SITE_CAPACITY];
+		s_sites_used++;
+	}
+
+	memset(reuse, 0, sizeof(Site));
+	reuse->owner = owner;
+	reuse->hash = hash;
+	reuse->info.frame_count = count;
+	std::copy(frames, frames + count, reuse->info.frames);
+	return reuse;
+}
+
+static inline size_t live_slot(const void *p) {
+	return mix((uintptr_t)p) % LIVE_CAPACITY;
+}
+
+// entry of a sampled block, or nullptr. Requires s_lock
+static Sample *find_sample(const void *p) {
+	if (s_live == nullptr)
+		return nullptr;
+
+	for (size_t i = live_slot(p); s_live[i].ptr != nullptr; i = (i + 1) % LIVE_CAPACITY) {
+		if (s_live[i].ptr == p)
+			return &s_live[i];
+	}
+	return nullptr;
+}
+
+static bool insert_sample(const Sample &sample) {
+	if (4 * (s_live_used + 1) > 3 * LIVE_CAPACITY)
+		return false;
+
+	size_t i = live_slot(sample.ptr);
+	while (s_live[i].ptr != nullptr)
+		i = (i + 1) % LIVE_CAPACITY;
+	s_live[i] = sample;
+	s_live_used++;
+	s_live_filter[live_slot(sample.ptr)].fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+// remove an entry, shifting back later entries of its probe sequence
+static void erase_sample(Sample *sample) {
+	s_live_filter[live_slot(sample->ptr)].fetch_sub(1, std::memory_order_relaxed);
+
+	size_t hole = sample - s_live;
+	for (size_t i = (hole + 1) % LIVE_CAPACITY; s_live[i].ptr != nullptr; i = (i + 1) % LIVE_CAPACITY) {
+		const size_t home = live_slot(s_live[i].ptr);
+		// move the entry unless its home lies cyclically in (hole, i]
+		if ((i > hole) ? (home <= hole || home > i) : (home <= hole && home > i)) {
+			s_live[hole] = s_live[i];
+			hole = i;
+		}
+	}
+	s_live[hole].ptr = nullptr;
+	s_live_used--;
+}
+
+static void drop_live(Sample *sample) {
+	msource_trace_site &info = s_sites[sample->site].info;
+	info.live_samples--;
+	info.live_est_bytes -= sample->weight;
+	erase_sample(sample);
+	live_samples.fetch_sub(1, std::memory_order_relaxed);
+}
+
+}
+
+size_t rate() {
+	return (size_t) load_rate();
+}
+
+void set_rate(size_t bytes) {
+	load_rate();
+	s_rate.store((ssize_t)std::min(bytes, (size_t)(SSIZE_MAX / 2)));
+
+	// other threads notice within DISABLED_RECHECK bytes
+	countdown = 0;
+	s_armed = false;
+}
+
+bool rearm() {
+	const ssize_t r = load_rate();
+	if (r == 0) {
+		countdown = DISABLED_RECHECK;
+		s_armed = false;
+		return false;
+	}
+
+	// uniform in [0, 2 * rate), so that regular allocation patterns do not
+	// line up with the interval
+	const ssize_t next = (ssize_t)(next_random() % (2 * (uint64_t)r));
+
+	// a countdown that was not drawn like this only arms the next one, which
+	// the allocation that ran it out counts against already. Otherwise every
+	// thread's first allocation would be sampled
+	if (!s_armed) {
+		s_armed = true;
+		countdown += next;
+		if (countdown >= 0)
+			return false;
+		countdown = (ssize_t)(next_random() % (2 * (uint64_t)r));
+		return !s_busy;
+	}
+
+	countdown = next;
+	return !s_busy;
+}
+
+void record_alloc(const void *owner, void *p, size_t sz, int thread_node) {
+	if (p == nullptr || s_busy)
+		return;
+	Busy busy;
+
+	void *frames[MAX_FRAMES];
+	const size_t count = capture(frames);
+	uint64_t hash = mix((uintptr_t)owner);
+	for (size_t i = 0; i < count; i++)
+		hash = mix(hash ^ (uintptr_t)frames[i]);
+
+	int node = -1;
+	lookupMemory(p, &node);
+	const bool remote = node >= 0 && thread_node >= 0 && node != thread_node;
+
+	// blocks larger than the interval are always sampled
+	const size_t weight = std::max(sz, rate());
+
+	std::lock_guard<numa::SpinLock> lock(s_lock);
+	if (!map_tables())
+		return;
+
+	Site *site = find_site(owner, hash, frames, count);
+	if (site == nullptr)
+		return;
+
+	site->info.samples++;
+	site->info.remote_samples += remote ? 1 : 0;
+	site->info.est_bytes += weight;
+
+	// the address may be stale, if its block was freed while sampling was off
+	if (Sample *old = find_sample(p))
+		drop_live(old);
+
+	if (insert_sample(Sample { p, weight, (size_t)(site - s_sites) })) {
+		site->info.live_samples++;
+		site->info.live_est_bytes += weight;
+		live_samples.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void record_free(void *p) {
+	if (s_busy || s_live_filter[live_slot(p)].load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::lock_guard<numa::SpinLock> lock(s_lock);
+	if (Sample *sample = find_sample(p))
+		drop_live(sample);
+}
+
+void record_resize(void *p, void *q, size_t sz) {
+	if (s_busy || s_live_filter[live_slot(p)].load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::lock_guard<numa::SpinLock> lock(s_lock);
+	Sample *sample = find_sample(p);
+	if (sample == nullptr)
+		return;
+
+	Sample moved = *sample;
+	moved.ptr = q;
+	moved.weight = std::max(sz, rate());
+	drop_live(sample);
+
+	if (insert_sample(moved)) {
+		msource_trace_site &info = s_sites[moved.site].info;
+		info.live_samples++;
+		info.live_est_bytes += moved.weight;
+		live_samples.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// expects s_lock to be held
+static void release_locked(const void *owner) {
+	// erasing shifts later entries back into the current one
+	for (size_t i = 0; i < LIVE_CAPACITY; ) {
+		if (s_live[i].ptr != nullptr && s_sites[s_live[i].site].owner == owner)
+			drop_live(&s_live[i]);
+		else
+			i++;
+	}
+}
+
+void release(const void *owner) {
+	if (live_samples.load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::lock_guard<numa::SpinLock> lock(s_lock);
+	if (s_sites != nullptr)
+		release_locked(owner);
+}
+
+void forget(const void *owner) {
+	std::lock_guard<numa::SpinLock> lock(s_lock);
+	if (s_sites == nullptr)
+		return;
+
+	// regions may be destroyed with live blocks
+	if (live_samples.load(std::memory_order_relaxed) != 0)
+		release_locked(owner);
+	for (size_t i = 0; i < SITE_CAPACITY; i++) {
+		if (s_sites[i].owner == owner)
+			s_sites[i].owner = TOMBSTONE;
+	}
+}
+
+std::vector<msource_trace_site> sites(const void *owner) {
+	std::vector<msource_trace_site> result;
+	if (s_busy)
+		return result;
+	Busy busy;
+
+	std::lock_guard<numa::SpinLock> lock(s_lock);
+	if (s_sites == nullptr)
+		return result;
+
+	for (size_t i = 0; i < SITE_CAPACITY; i++) {
+		if (s_sites[i].owner == owner)
+			result.push_back(s_sites[i].info);
+	}
+	return result;
+}
+
+size_t report(const void *owner, const char *description, bool live_only, FILE *out) {
+	std::vector<msource_trace_site> all = sites(owner);
+	if (live_only) {
+		all.erase(std::remove_if(all.begin(), all.end(),
+			[](const msource_trace_site &s) { return s.live_samples == 0; }), all.end());
+	}
+	if (all.empty())
+		return 0;
+
+	std::sort(all.begin(), all.end(), [](const msource_trace_site &a, const msource_trace_site &b) {
+		return (a.live_est_bytes != b.live_est_bytes)
+			? a.live_est_bytes > b.live_est_bytes
+			: a.est_bytes > b.est_bytes;
+	});
+
+	// frames within this library are the allocator's, not the caller's
+	Dl_info self;
+	const void *self_base = dladdr((void*) &report, &self) ? self.dli_fbase : nullptr;
+
+	if (rate() != 0)
+		fprintf(out, "Sampled allocations of MemSource %s (one per %zu bytes):\n", description, rate());
+	else
+		fprintf(out, "Sampled allocations of MemSource %s (sampling stopped):\n", description);
+	for (const msource_trace_site &s : all) {
+		fprintf(out, "  ~%zu bytes live in %zu samples, ~%zu bytes in %zu samples (%zu remote) from\n",
+			s.live_est_bytes, s.live_samples, s.est_bytes, s.samples, s.remote_samples);
+
+		size_t first = 0;
+		Dl_info info;
+		while (first < s.frame_count && dladdr(s.frames[first], &info)
+				&& info.dli_fbase == self_base)
+			first++;
+		if (first == s.frame_count)
+			first = 0;
+
+		for (size_t i = first; i < s.frame_count; i++) {
+			if (dladdr(s.frames[i], &info) && info.dli_fname != nullptr) {
+				const char *name = strrchr(info.dli_fname, '/');
+				fprintf(out, "    #%zu %s+0x%zx %s\n", i - first,
+					(name != nullptr) ? name + 1 : info.dli_fname,
+					(size_t)((const char*) s.frames[i] - (const char*) info.dli_fbase),
+					(info.dli_sname != nullptr) ? info.dli_sname : "");
+			} else {
+				fprintf(out, "    #%zu %p\n", i - first, s.frames[i]);
+			}
+		}
+	}
+	return all.size();
+}
+
+}
+}
+}
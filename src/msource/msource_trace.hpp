@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstddef>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "PGASUS/msource/msource.hpp"
+
+namespace numa {
+namespace msource {
+
+/**
+ * Sampled allocation tracing, see MemSource::setTraceSampling(). Sources are
+ * identified by an opaque owner pointer. The sampling test is inlined into the
+ * allocation path; everything else happens out of line, for sampled blocks
+ * only. The tracer never allocates from a MemSource itself.
+ */
+namespace trace {
+
+// sampled blocks not yet freed, in all sources
+extern std::atomic<size_t> live_samples;
+
+// bytes the calling thread allocates until its next sample
+extern thread_local ssize_t countdown __attribute__((tls_model("initial-exec")));
+
+// sampling interval in bytes, 0 if disabled
+size_t rate();
+void set_rate(size_t bytes);
+
+// restarts the countdown. Returns whether the allocation that ran it out is sampled
+bool rearm();
+
+static inline bool should_sample(size_t sz) {
+	countdown -= (ssize_t)sz;
+	return countdown < 0 && rearm();
+}
+
+// record a sampled block of owner, allocated by a thread on thread_node
+void record_alloc(const void *owner, void *p, size_t sz, int thread_node);
+
+// forget a block (before it is freed), if it was sampled
+void record_free(void *p);
+
+// a block was resized, possibly moving it from p to q
+void record_resize(void *p, void *q, size_t sz);
+
+// drop the records of owner's blocks, which were all released at once
+void release(const void *owner);
+
+// drop all records of a destroyed owner
+void forget(const void *owner);
+
+// call sites of owner's sampled blocks
+std::vector<msource_trace_site> sites(const void *owner);
+
+// print the call sites of owner's sampled blocks, optionally only those with
+// live blocks. Returns the number of sites printed
+size_t report(const void *owner, const char *description, bool live_only, FILE *out);
+
+}
+
+}
+}
@@ -2908,7 +2908,7 @@ static void* tmalloc_small(mstate m, size_t nb) {
 
 /* --------------------------- realloc support --------------------------- */
 
-static void* internal_realloc(mstate m, void* oldmem, size_t bytes) {
+static void* internal_realloc(mstate m, void* oldmem, size_t bytes, int can_move) {
   if (bytes >= MAX_REQUEST) {
     MALLOC_FAILURE_ACTION;
     return 0;
@@ -2925,8 +2925,10 @@ static void* internal_realloc(mstate m, void* oldmem, size_t bytes) {
     if (RTCHECK(ok_address(m, oldp) && ok_cinuse(oldp) &&
                 ok_next(oldp, next) && ok_pinuse(next))) {
       size_t nb = request2size(bytes);
-      if (is_mmapped(oldp))
-        newp = mmap_resize(m, oldp, nb);
+      if (is_mmapped(oldp)) {
+        if (can_move)
+          newp = mmap_resize(m, oldp, nb);
+      }
       else if (oldsize >= nb) { /* already big enough */
         size_t rsize = oldsize - nb;
         newp = oldp;
@@ -2964,6 +2966,9 @@ static void* internal_realloc(mstate m, void* oldmem, size_t bytes) {
       check_inuse_chunk(m, newp);
       return chunk2mem(newp);
     }
+    else if (!can_move) {
+      return 0;
+    }
     else {
       void* newmem = internal_malloc(m, bytes);
       if (newmem != 0) {
@@ -3473,7 +3478,7 @@ void* dlrealloc(void* oldmem, size_t bytes) {
       return 0;
     }
 #endif /* FOOTERS */
-    return internal_realloc(m, oldmem, bytes);
+    return internal_realloc(m, oldmem, bytes, 1);
   }
 }
 
@@ -3890,7 +3895,25 @@ void* mspace_realloc(mspace msp, void* oldmem, size_t bytes) {
       USAGE_ERROR_ACTION(ms,ms);
       return 0;
     }
-    return internal_realloc(ms, oldmem, bytes);
+    return internal_realloc(ms, oldmem, bytes, 1);
+  }
+}
+
+void* mspace_realloc_in_place(mspace msp, void* oldmem, size_t bytes) {
+  if (oldmem == 0)
+    return 0;
+  else {
+#if FOOTERS
+    mchunkptr p  = mem2chunk(oldmem);
+    mstate ms = get_mstate_for(p);
+#else /* FOOTERS */
+    mstate ms = (mstate)msp;
+#endif /* FOOTERS */
+    if (!ok_magic(ms)) {
+      USAGE_ERROR_ACTION(ms,ms);
+      return 0;
+    }
+    return internal_realloc(ms, oldmem, bytes, 0);
   }
 }
 
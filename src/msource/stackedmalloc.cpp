@@ -68,7 +68,8 @@ public:
 				char buff[4096];
 				snprintf(buff, sizeof(buff) / sizeof(buff[0]), "nodeLocal(src=%zu dst=%zu)",
 						node, n);
-				msources[n] = numa::MemSource::create(n, 1LL<<24, buff, node);
+				msources[n] = numa::MemSource::create(n, numa::MemSource::defaultGrowth().min_arena,
+					buff, node);
 			}
 		}
 
@@ -116,10 +117,8 @@ private:
 	// stack stored within local msource
 	numa::msvector<numa::Place> _place_stack;
 
-	// currently used mem source
-	numa::MemSource             _curr_msource;
-
-	static const size_t         s_local_source_size = (size_t)(1 << 24);
+	// currently used mem source, kept alive by the stack or the members above
+	numa::MemSourceRef          _curr_msource;
 
 	inline const numa::MemSource& get_node_msource(int n) {
 		return (n >= 0 && size_t(n) == _node)
@@ -177,7 +176,7 @@ public:
 		// create msource
 		char buff[4096];
 		snprintf(buff, sizeof(buff) / sizeof(buff[0]), "local(%zX)", _tid % 0xFFFFFFFF);
-		_thread_msource = numa::MemSource::create(_node, s_local_source_size, buff);
+		_thread_msource = numa::MemSource::create(_node, numa::MemSource::defaultGrowth().min_arena, buff);
 
 		// create stack from local msource
 		_place_stack = numa::msvector<numa::Place>(_thread_msource);
@@ -195,14 +194,19 @@ public:
 	// Push a Place onto the allocation-source stack
 	inline void push(const numa::Place &p) {
 		_place_stack.push_back(p);
-		_curr_msource = get_place_msource(p);
+		_curr_msource = get_place_msource(_place_stack.back());
+	}
+
+	inline void push(numa::Place &&p) {
+		_place_stack.push_back(std::move(p));
+		_curr_msource = get_place_msource(_place_stack.back());
 	}
 
 	// Pop the top MemSource from the allocation-source stack
 	inline numa::Place pop() {
 		assert(!_place_stack.empty());
 
-		numa::Place result = _place_stack.back();
+		numa::Place result = std::move(_place_stack.back());
 		_place_stack.pop_back();
 		_curr_msource = get_curr_msource();
 		return result;
@@ -225,17 +229,26 @@ public:
 
 	// Get the current allocation MemSource (may be top of stack or thread-local)
 	// During initialization, this might return the global allocator
-	inline const numa::MemSource& get_msource() {
+	inline numa::MemSourceRef get_msource() const {
 		return _curr_msource;
 	}
 };
 
+//
+// Fast TLS pointer, set once the thread's storage exists. The initial-exec
+// model spares the __tls_get_addr() call that the shared library's default
+// model needs on every access. The pthread key owns the storage.
+//
+thread_local ThreadLocalStorage *s_tls __attribute__((tls_model("initial-exec"))) = nullptr;
+
 //
 // TLS deleter
 //
 void tlsDestructionFunc(void *data) {
 	ThreadLocalStorage *ptr = static_cast<ThreadLocalStorage*>(data);
 	if (ptr != nullptr) {
+		// later allocations of this thread take the slow path again
+		s_tls = nullptr;
 		numa::MemSource::global().destruct(ptr);
 	}
 }
@@ -262,21 +275,26 @@ struct GetKeyInitializer {
 //
 // TLS getter
 //
-ThreadLocalStorage &getTlsImpl() {
+__attribute__((noinline)) ThreadLocalStorage &getTlsImpl() {
 	// the order is important here, as ThreadLocalStorage::init() will probably call malloc() again.
+	// Those calls find the storage and allocate from the global msource until init() is done
 	void *ptr = pthread_getspecific(getKey());
 	if (ptr == nullptr) {
 		ptr = (void*) numa::MemSource::global().construct<ThreadLocalStorage>();
 		pthread_setspecific(getKey(), ptr);
+		s_tls = static_cast<ThreadLocalStorage*>(ptr);
 		static_cast<ThreadLocalStorage*>(ptr)->init();
 	}
+	s_tls = static_cast<ThreadLocalStorage*>(ptr);
 
 	return *static_cast<ThreadLocalStorage*>(ptr);
 }
 
-ThreadLocalStorage &getTls() {
-	ThreadLocalStorage &tls = getTlsImpl();
-	return tls;
+inline ThreadLocalStorage &getTls() {
+	ThreadLocalStorage *tls = s_tls;
+	if (__builtin_expect(tls != nullptr, 1))
+		return *tls;
+	return getTlsImpl();
 }
 
 }
@@ -291,6 +309,11 @@ void push(const Place &p) {
 	getTls().push(p);
 }
 
+void push(Place &&p) {
+	assert(p.valid());
+	getTls().push(std::move(p));
+}
+
 void push_all(const PlaceStack &places) {
 	assert(std::all_of(places.begin(), places.end(),
 		std::bind(&Place::valid, std::placeholders::_1)));
@@ -308,7 +331,7 @@ PlaceStack pop_all() {
 }
 
 MemSource curr_msource() {
-	return getTls().get_msource();
+	return getTls().get_msource().msource();
 }
 
 }
@@ -327,7 +350,7 @@ inline void *stackedmalloc(size_t sz) throw() {
 	void *result = getTls().get_msource().alloc(sz);
 
 #if NUMA_STACKEDMALLOC_DEBUG
-	printf("[alloc] sz=%zd source=%s result=%p\n", sz, getTls().get_msource().getDescription().c_str(), result);
+	printf("[alloc] sz=%zd source=%s result=%p\n", sz, getTls().get_msource().msource().getDescription().c_str(), result);
 	fflush(stdout);
 #endif
 
@@ -341,7 +364,7 @@ inline void *stackedmalloc_aligned(size_t align, size_t sz) throw() {
 	void *result = getTls().get_msource().allocAligned(align, sz);
 
 #if NUMA_STACKEDMALLOC_DEBUG
-	printf("[align] sz=%zd align=%zd source=%s result=%p\n", sz, align, getTls().get_msource().getDescription().c_str(), result);
+	printf("[align] sz=%zd align=%zd source=%s result=%p\n", sz, align, getTls().get_msource().msource().getDescription().c_str(), result);
 	fflush(stdout);
 #endif
 
@@ -356,31 +379,52 @@ extern "C" void free(void *p) throw() {
 	numa::MemSource::free(p);
 }
 
+extern "C" PGASUS_MSOURCE_EXPORT void free_sized(void *p, size_t sz) throw() {
+	numa::MemSource::freeSized(p, sz);
+}
+
+extern "C" PGASUS_MSOURCE_EXPORT void free_aligned_sized(void *p, size_t align, size_t sz) throw() {
+	numa::MemSource::freeAlignedSized(p, align, sz);
+}
+
 extern "C" void* malloc(size_t sz) throw() {
 	return stackedmalloc(sz);
 }
 
 extern "C" void* calloc(size_t n, size_t sz) throw() {
-	size_t total = n * sz;
-	void *ptr = stackedmalloc(total);
-	if (ptr != nullptr)
-		memset(ptr, 0, total);
+	size_t total;
+	if (__builtin_mul_overflow(n, sz, &total)) {
+		errno = ENOMEM;
+		return nullptr;
+	}
+
+	void *ptr = getTls().get_msource().allocZeroed(total);
+
+#if NUMA_STACKEDMALLOC_DEBUG
+	printf("[calloc] sz=%zd source=%s result=%p\n", total, getTls().get_msource().msource().getDescription().c_str(), ptr);
+	fflush(stdout);
+#endif
+
 	return ptr;
 }
 
 extern "C" void* realloc(void *p, size_t sz) throw() {
-	// don't bother if the block is to be shrinked
-	size_t old_size = (p != nullptr) ? numa::MemSource::allocatedSize(p) : 0;
-	if (sz < old_size)
-		return p;
+	if (p != nullptr) {
+		void *presized = numa::MemSource::resize(p, sz);
+		if (presized != nullptr)
+			return presized;
+	}
 
-	// allocate new
+	// allocate new. Blocks that could not be shrunk in place are copied as
+	// well: a small block keeps its size class, and free_sized() would look
+	// for it in the class of its new size
+	size_t old_size = (p != nullptr) ? numa::MemSource::allocatedSize(p) : 0;
 	void *pnew = stackedmalloc(sz);
 	if (pnew == nullptr)
 		return nullptr;
 
 	if (p != nullptr) {
-		memmove(pnew, p, old_size);
+		memmove(pnew, p, std::min(old_size, sz));
 		numa::MemSource::free(p);
 	}
 
@@ -425,6 +469,19 @@ extern "C" void* pvalloc(size_t __size) throw() {
 	return stackedmalloc_aligned(numa::malloc::MEM_PAGE_SIZE, __size);
 }
 
+/*
+ * Sized deallocation (C++14). operator new is left to the runtime, which
+ * allocates with malloc()
+ */
+
+PGASUS_MSOURCE_EXPORT void operator delete(void *p, std::size_t sz) noexcept {
+	numa::MemSource::freeSized(p, sz);
+}
+
+PGASUS_MSOURCE_EXPORT void operator delete[](void *p, std::size_t sz) noexcept {
+	numa::MemSource::freeSized(p, sz);
+}
+
 extern "C" void malloc_stats(void) throw() {
 }
 
@@ -8,6 +8,7 @@
 #include "PGASUS/tasking/synchronizable.hpp"
 #include "PGASUS/tasking/task.hpp"
 #include "base/debug.hpp"
+#include "tasking/task_pool.hpp"
 #include "tasking/task_scheduler.hpp"
 #include "tasking/worker_thread.hpp"
 
@@ -39,6 +40,22 @@ Task::~Task() {
 	assert(ref_count() == 0);
 }
 
+void* Task::operator new(size_t sz, const Node &node) {
+	return TaskPool::alloc(sz, node, true);
+}
+
+void* Task::operator new(size_t sz) {
+	return TaskPool::alloc(sz, Node(), false);
+}
+
+void Task::operator delete(void *p, const Node &) {
+	TaskPool::free(p);
+}
+
+void Task::operator delete(void *p) {
+	TaskPool::free(p);
+}
+
 size_t Task::home_thread_id() const {
 	return (_home_thread != nullptr) ? _home_thread->id() : (size_t)-1;
 }
@@ -174,6 +191,26 @@ void Task::done() {
 	log(DebugLevel::INFO, "Task[%p]: Done", (void*)this);
 }
 
+/**
+ * Migration task
+ */
+MigrationTask::MigrationTask(const MemSource &msource, int phys_dst, Priority prio)
+	: Task(prio)
+	, _msource(msource)
+	, _dst(phys_dst)
+	, _bytes_done(0)
+	, _bytes_total(0)
+	, _pages(0)
+{
+}
+
+void MigrationTask::do_run() {
+	_pages = _msource.migrate(_dst, [this] (size_t done, size_t total) {
+		_bytes_total = total;
+		_bytes_done = done;
+	});
+}
+
 }
 }
 
@@ -1,6 +1,7 @@
 #include "tasking/task_collection.hpp"
 
 #include <cassert>
+#include <cstdint>
 #include <new>
 
 
@@ -10,6 +11,23 @@ using namespace numa::msource;
 namespace numa {
 namespace tasking {
 
+namespace {
+
+/**
+ * Cheap per-thread random number in [0, n), to pick the first steal victim
+ */
+inline size_t random_index(size_t n) {
+	static thread_local uint64_t state = 0;
+	if (state == 0)
+		state = reinterpret_cast<uintptr_t>(&state) | 1;
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state % n;
+}
+
+}
+
 TaskCollection* TaskCollection::create(const numa::MemSource &alloc, size_t max_threads) {
 	void *mem = alloc.alloc(sizeof(TaskCollection));
 	return new (mem) TaskCollection(alloc, max_threads);
@@ -39,13 +57,13 @@ void TaskCollection::register_thread(size_t idx) {
 void TaskCollection::deregister_thread(size_t idx) {
 	assert(idx < _thread_tasks.size());
 	
-	TaskQueue *tq = _thread_tasks[idx].queue.load();
+	ThreadQueue *tq = _thread_tasks[idx].queue.load();
 	_thread_tasks[idx].queue = nullptr;
 	
 	// move tasks to global queue
 	Task *task = nullptr;
-	while (tq->try_pop_front(task)) {
-		_global_tasks.push_back(task);
+	while (tq->try_steal(&task)) {
+		_global_tasks.push(task);
 	}
 	
 	// delete queue
@@ -63,23 +81,29 @@ Task* TaskCollection::try_get(size_t th_idx) {
 	
 	Task *task = nullptr;
 	
-	// try to find task. first thread-specific
-	try_get_thread_task(th_idx, &task);
+	// try to find task. first thread-specific: newest own task, then handed-in ones
+	ThreadQueue *own = get_thread_queue(th_idx);
+	if (own != nullptr) {
+		task = own->deque.pop();
+		if (task == nullptr)
+			own->inbox.try_pop(&task);
+	}
 	
 	// then search global
 	if (task == nullptr)
-		_global_tasks.try_pop_front(task);
+		_global_tasks.try_pop(&task);
 	
 	// then try to steal from other threads. randomly to prevent imbalance.
 	if (task == nullptr) {
 		size_t cnt = _thread_tasks.size();
 		
 		if (cnt > 0) {
-			size_t start = _random() % cnt;
+			size_t start = random_index(cnt);
 			for (size_t i = start; i < start+cnt; i++) {
 				size_t idx = i;
 				if (idx >= cnt) idx -= cnt;
-				if (try_get_thread_task(idx, &task))
+				ThreadQueue *tq = get_thread_queue(idx);
+				if (tq != nullptr && tq != own && tq->try_steal(&task))
 					break;
 			}
 		}
@@ -91,13 +115,15 @@ Task* TaskCollection::try_get(size_t th_idx) {
 /**
  * Inserts the task into the collection.
  */
-void TaskCollection::put(Task* t, size_t th_idx) {
-	TaskQueue *dst = get_thread_queue(th_idx);
+void TaskCollection::put(Task* t, size_t th_idx, bool owner) {
+	ThreadQueue *dst = get_thread_queue(th_idx);
 	if (dst == nullptr)
-		dst = &_global_tasks;
-	dst->push_back(t);
+		_global_tasks.push(t);
+	else if (owner)
+		dst->deque.push(t);
+	else
+		dst->inbox.push(t);
 }
 
-
 }
 }
@@ -4,13 +4,13 @@
 #include <cstddef>
 #include <memory>
 #include <mutex>
-#include <random>
 #include <vector>
 
 #include "PGASUS/base/spinlock.hpp"
 #include "PGASUS/msource/msource_types.hpp"
 #include "PGASUS/PGASUS_export.h"
 #include "PGASUS/synced_containers.hpp"
+#include "tasking/work_stealing_deque.hpp"
 
 
 namespace numa {
@@ -22,6 +22,10 @@ class Task;
 /**
  * All tasks that are to run on a number of threads. Contains a local thread
  * queue for each thread, as well as a global queue of untied threads.
+ *
+ * A thread queue is a work-stealing deque that its owner pushes to and pops
+ * from without locking, plus an inbox for tasks that other threads hand to
+ * that thread. Idle threads steal from the other threads' queues.
  */
 class PGASUS_EXPORT TaskCollection
 {
@@ -29,8 +33,42 @@ private:
 	typedef numa::util::SyncDeque<Task*, numa::MemSourceAllocator<Task*>> TaskQueue;
 	typedef numa::SpinLock LockType;
 
+	/**
+	 * Locked FIFO queue that only takes its lock if it is not empty
+	 */
+	struct Inbox {
+		TaskQueue               queue;
+		std::atomic<size_t>     count;
+
+		explicit Inbox(const numa::MemSource &ms) : queue(ms), count(0) {}
+
+		inline void push(Task *t) {
+			queue.push_back(t);
+			count += 1;
+		}
+
+		inline bool try_pop(Task **t) {
+			if (count.load(std::memory_order_relaxed) == 0 || !queue.try_pop_front(*t))
+				return false;
+			count -= 1;
+			return true;
+		}
+	};
+
+	struct ThreadQueue {
+		WorkStealingDeque<Task>     deque;	// pushed and popped by the owner only
+		Inbox                       inbox;	// pushed to by other threads
+
+		explicit ThreadQueue(const numa::MemSource &ms) : deque(ms), inbox(ms) {}
+
+		inline bool try_steal(Task **t) {
+			*t = deque.steal();
+			return *t != nullptr || inbox.try_pop(t);
+		}
+	};
+
 	struct TaskQueueEntry {
-		std::atomic<TaskQueue*> queue;
+		std::atomic<ThreadQueue*> queue;
 		LockType lock;
 
 		TaskQueueEntry() : queue(nullptr) {}
@@ -45,7 +83,7 @@ private:
 			if (queue.load() == nullptr) {
 				std::lock_guard<LockType> guard(lock);
 				if (queue.load() == nullptr)
-					queue = ms.construct<TaskQueue>(ms);
+					queue = ms.construct<ThreadQueue>(ms);
 			}
 		}
 	};
@@ -54,28 +92,18 @@ private:
 
 	numa::MemSource             _alloc;
 
-	TaskQueue                   _global_tasks;
+	Inbox                       _global_tasks;
 	ThreadTaskQueue             _thread_tasks;
 
-	std::random_device          _random;
-
 	TaskCollection(const numa::MemSource &alloc, size_t max_threads);
 
 	/**
 	 * Return given thread task queue, or null of not exists
 	 */
-	inline TaskQueue *get_thread_queue(size_t idx)  {
+	inline ThreadQueue *get_thread_queue(size_t idx)  {
 		return (idx < _thread_tasks.size()) ? _thread_tasks[idx].queue.load() : nullptr;
 	}
 
-	/**
-	 * try to get task from task queue associated with given index
-	 */
-	inline bool try_get_thread_task(size_t idx, Task **task) {
-		TaskQueue *tq = get_thread_queue(idx);
-		return (tq != nullptr) ? tq->try_pop_front(*task) : false;
-	}
-
 public:
 
 	static TaskCollection* create(const numa::MemSource &alloc, size_t max_threads);
@@ -92,14 +120,16 @@ public:
 	void deregister_thread(size_t idx);
 
 	/**
-	 * Try to get a thread from the collection.
+	 * Try to get a thread from the collection. Must be called by the thread
+	 * th_idx, if that is a registered thread.
 	 */
 	Task* try_get(size_t th_idx);
 
 	/**
-	 * Inserts the task into the collection.
+	 * Inserts the task into the collection. If the calling thread is th_idx
+	 * itself, set owner to use its deque instead of its inbox.
 	 */
-	void put(Task* t, size_t th_idx);
+	void put(Task* t, size_t th_idx, bool owner);
 };
 
 
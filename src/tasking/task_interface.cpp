@@ -47,6 +47,9 @@ public:
 		if (sem_wait(&_semaphore) != 0) {
 			assert(false);
 		}
+		// the signaling thread still holds our lock while it posts. wait
+		// for it to let go before this object goes out of scope
+		is_waiting();
 	}
 };
 
@@ -169,6 +172,15 @@ void prefaultWorkerThreadStorages(size_t bytes) {
 		numa::debug::log(numa::debug::CRITICAL, "Prefaulted %zd bytes (%zd requested) on %zd thread msources", minPrefault, bytes, count);
 }
 
+MigrationRef migrateAsync(const MemSource &msource, const Node &dst, Priority prio) {
+	assert(dst.valid());
+
+	numa::PlaceGuard guard(dst);
+	MigrationRef task = tasking::MigrationTask::create(msource, dst.physicalId(), prio);
+	tasking::spawn_task(dst, task.get());
+	return task;
+}
+
 namespace tasking {
 void spawn_task(const Node &node, Task *task) {
 	Scheduler *sched = node.valid() ? Scheduler::get_scheduler(node) : nullptr;
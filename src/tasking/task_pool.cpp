@@ -0,0 +1,105 @@
+#include "tasking/task_pool.hpp"
+
+#include <cassert>
+#include <new>
+
+#include "PGASUS/msource/msource.hpp"
+#include "tasking/worker_thread.hpp"
+
+
+namespace numa {
+namespace tasking {
+
+TaskPool::TaskPool(const MemSource &ms)
+	: _msource(ms)
+{
+	for (size_t i = 0; i < CLASSES; i++) {
+		_free[i] = nullptr;
+		_cached[i] = 0;
+		_remote[i] = nullptr;
+	}
+}
+
+void *TaskPool::get(size_t cls) {
+	if (_free[cls] == nullptr) {
+		// take over what other threads have freed
+		Block *list = _remote[cls].exchange(nullptr, std::memory_order_acquire);
+		for (Block *b = list; b != nullptr; b = b->next)
+			_cached[cls] += 1;
+		_free[cls] = list;
+	}
+
+	Block *b = _free[cls];
+	if (b == nullptr)
+		return _msource.alloc((cls + 1) * GRANULARITY);
+
+	_free[cls] = b->next;
+	_cached[cls] -= 1;
+	return b;
+}
+
+void TaskPool::put(void *mem, size_t cls) {
+	Block *b = static_cast<Block*>(mem);
+	WorkerThread *th = WorkerThread::curr_worker_thread();
+
+	if (th != nullptr && th->task_pool() == this) {
+		if (_cached[cls] >= MAX_CACHED) {
+			MemSource::free(mem);
+			return;
+		}
+		b->next = _free[cls];
+		_free[cls] = b;
+		_cached[cls] += 1;
+	}
+	else {
+		b->next = _remote[cls].load(std::memory_order_relaxed);
+		while (!_remote[cls].compare_exchange_weak(b->next, b,
+				std::memory_order_release, std::memory_order_relaxed)) {}
+	}
+}
+
+/**
+ * Memory for a task object. Taken from the calling worker's pool if
+ * pooled is set, the worker runs on node (or node is invalid), and the
+ * object is small enough. From malloc() otherwise.
+ */
+void *TaskPool::alloc(size_t sz, const Node &node, bool pooled) {
+	size_t total = sz + sizeof(Header);
+	Header *h;
+
+	WorkerThread *th = pooled ? WorkerThread::curr_worker_thread() : nullptr;
+	if (th != nullptr && th->task_pool() != nullptr
+			&& (!node.valid() || node == th->homeNode())
+			&& total <= CLASSES * GRANULARITY) {
+		size_t cls = (total - 1) / GRANULARITY;
+		h = static_cast<Header*>(th->task_pool()->get(cls));
+		if (h == nullptr)
+			throw std::bad_alloc();
+		h->pool = th->task_pool();
+		h->cls = cls;
+	}
+	else {
+		h = static_cast<Header*>(::operator new(total));
+		h->pool = nullptr;
+		h->cls = 0;
+	}
+
+	return h + 1;
+}
+
+/**
+ * Return memory from alloc()
+ */
+void TaskPool::free(void *p) {
+	if (p == nullptr)
+		return;
+
+	Header *h = static_cast<Header*>(p) - 1;
+	if (h->pool != nullptr)
+		h->pool->put(h, h->cls);
+	else
+		::operator delete(h);
+}
+
+}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "PGASUS/base/node.hpp"
+#include "PGASUS/msource/msource_types.hpp"
+
+
+namespace numa {
+namespace tasking {
+
+
+/**
+ * Recycles the memory of small task objects for one worker thread. Blocks
+ * come from the worker's node-local MemSource and carry a header naming
+ * their pool. The owning worker allocates and frees without atomics; other
+ * threads free onto a lock-free list that the owner takes over when its own
+ * list runs empty.
+ *
+ * Pools are never destroyed, as tasks may outlive their worker threads.
+ */
+class TaskPool
+{
+private:
+	static constexpr size_t GRANULARITY = 128;
+	static constexpr size_t CLASSES     = 4;		// blocks of up to 512 bytes
+	static constexpr size_t MAX_CACHED  = 256;		// per class
+
+	struct Block {
+		Block                  *next;
+	};
+
+	// keeps the task behind it aligned to Task::MAX_ALIGN
+	struct alignas(16) Header {
+		TaskPool               *pool;				// null: from malloc()
+		size_t                  cls;
+	};
+
+	numa::MemSource             _msource;
+
+	// owner only
+	Block                      *_free[CLASSES];
+	size_t                      _cached[CLASSES];
+
+	// freed by other threads
+	std::atomic<Block*>         _remote[CLASSES];
+
+	void *get(size_t cls);
+	void put(void *mem, size_t cls);
+
+public:
+	explicit TaskPool(const numa::MemSource &ms);
+
+	TaskPool(const TaskPool &other) = delete;
+	TaskPool& operator=(const TaskPool &other) = delete;
+
+	/**
+	 * Memory for a task object. Taken from the calling worker's pool if
+	 * pooled is set, the worker runs on node (or node is invalid), and the
+	 * object is small enough. From malloc() otherwise.
+	 */
+	static void *alloc(size_t sz, const Node &node, bool pooled);
+
+	/**
+	 * Return memory from alloc()
+	 */
+	static void free(void *p);
+};
+
+
+}
+}
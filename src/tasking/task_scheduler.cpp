@@ -1,15 +1,16 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
-#include <semaphore.h>
-#include <sys/time.h>
 #include <sys/types.h>
-#include <time.h>
 
 #include "PGASUS/base/node.hpp"
 #include "PGASUS/base/topology.hpp"
@@ -17,7 +18,9 @@
 #include "PGASUS/msource/msource_allocator.hpp"
 #include "PGASUS/msource/node_replicated.hpp"
 #include "PGASUS/tasking/task.hpp"
+#include "base/strutil.hpp"
 #include "tasking/task_collection.hpp"
+#include "tasking/task_pool.hpp"
 #include "tasking/task_scheduler.hpp"
 #include "tasking/thread_manager.hpp"
 #include "tasking/worker_thread.hpp"
@@ -57,13 +60,67 @@ SchedulingDomain* globalDomain() {
 
 }
 
+const StealPolicy& StealPolicy::get() {
+	static const StealPolicy policy = [] {
+		StealPolicy result;
+		result.max_neighbors = (size_t)-1;
+
+		const char *str = getenv("NUMA_STEAL_NEIGHBORS");
+		if (str != nullptr && sscanf(str, "%zu", &result.max_neighbors) != 1) {
+			fprintf(stderr, "Invalid NUMA_STEAL_NEIGHBORS value (%s), "
+				"stealing from all nodes.\n", str);
+			result.max_neighbors = (size_t)-1;
+		}
+
+		str = getenv("NUMA_STEAL_THRESHOLDS");
+		if (str != nullptr) {
+			for (const std::string &part : util::split(str, ',')) {
+				size_t value;
+				if (sscanf(part.c_str(), "%zu", &value) != 1) {
+					fprintf(stderr, "Invalid NUMA_STEAL_THRESHOLDS value (%s), "
+						"using defaults.\n", str);
+					result.thresholds.clear();
+					break;
+				}
+				result.thresholds.push_back(value);
+			}
+		}
+		if (result.thresholds.empty())
+			result.thresholds = { 1, 4 };
+
+		return result;
+	}();
+	return policy;
+}
+
+const IdlePolicy& IdlePolicy::get() {
+	static const IdlePolicy policy = [] {
+		IdlePolicy result = { 8, 10 * 1000 };
+
+		const char *str = getenv("NUMA_IDLE_SPIN");
+		if (str != nullptr && sscanf(str, "%zu", &result.spin_polls) != 1) {
+			fprintf(stderr, "Invalid NUMA_IDLE_SPIN value (%s), using default.\n", str);
+			result.spin_polls = 8;
+		}
+
+		str = getenv("NUMA_IDLE_PARK_USEC");
+		if (str != nullptr && (sscanf(str, "%zu", &result.park_usec) != 1 || result.park_usec == 0)) {
+			fprintf(stderr, "Invalid NUMA_IDLE_PARK_USEC value (%s), using default.\n", str);
+			result.park_usec = 10 * 1000;
+		}
+
+		return result;
+	}();
+	return policy;
+}
+
 /**
  * Encapsulates all priorities within one scheduling domain
  */
 SchedulingDomain::SchedulingDomain(const MemSource &ms)
 	: _msource(ms.valid() ? ms : MemSource::global())
 	, _active_thread_ids(_msource)
-	, _topPriorityIdx(0)
+	, _occupied(0)
 	, _priorities(Priority::max_index() + 1, _msource)
 {
 }
@@ -79,22 +136,51 @@ SchedulingDomain::~SchedulingDomain() {
  * Always picks the highest-priority task. Prefers tasks bound to that thid
  */
 Task* SchedulingDomain::try_get_task(int thid) {
-	for (ssize_t idx = _topPriorityIdx.load(); idx >= 0; --idx) {
-		if (_priorities[idx].count.load() > 0) {
-			Task *result = _priorities[idx].tasks.load()->try_get(thid);
-			if (result != nullptr) {
-				_priorities[idx].count -= 1;
-				return result;
-			}
-		}
+	uint64_t occupied = _occupied.load();
+	while (occupied != 0) {
+		size_t idx = 63 - __builtin_clzll(occupied);
+		occupied &= ~(UINT64_C(1) << idx);
+
+		Task *result = try_get_task(thid, idx);
+		if (result != nullptr)
+			return result;
 	}
 	return nullptr;
 }
 
+/**
+ * Returns a task of the given priority index, or null
+ */
+Task* SchedulingDomain::try_get_task(int thid, size_t idx) {
+	PriorityTasks &pt = _priorities[idx];
+	if (pt.count.load() == 0)
+		return nullptr;
+
+	Task *result = pt.tasks.load()->try_get(thid);
+	if (result != nullptr && pt.count.fetch_sub(1) == 1) {
+		// level ran empty. re-mark it, if a task was put in the meantime
+		_occupied.fetch_and(~(UINT64_C(1) << idx));
+		if (pt.count.load() > 0)
+			_occupied.fetch_or(UINT64_C(1) << idx);
+	}
+	return result;
+}
+
+/**
+ * Number of tasks in this domain, for steal decisions
+ */
+size_t SchedulingDomain::queued() const {
+	size_t sum = 0;
+	for (uint64_t occupied = _occupied.load(std::memory_order_relaxed); occupied != 0;
+			occupied &= occupied - 1)
+		sum += _priorities[__builtin_ctzll(occupied)].count.load(std::memory_order_relaxed);
+	return sum;
+}
+
 /**
  * Inserts a task into this scheduling domain
  */
-void SchedulingDomain::put_task(Task* t, int thid) {
+void SchedulingDomain::put_task(Task* t, int thid, bool owner) {
 	size_t idx = t->priority().index();
 
 	// create lazy, if necessary
@@ -120,14 +206,10 @@ void SchedulingDomain::put_task(Task* t, int thid) {
 		}
 	}
 
-	_priorities[idx].tasks.load()->put(t, thid);
-	_priorities[idx].count += 1;
-
-	// update priority search head
-	size_t expected = _topPriorityIdx.load();
-	while (idx > expected) {
-		if (_topPriorityIdx.compare_exchange_weak(expected, idx)) break;
-	}
+	// count and mark first, so that the count never drops below zero
+	if (_priorities[idx].count.fetch_add(1) == 0)
+		_occupied.fetch_or(UINT64_C(1) << idx);
+	_priorities[idx].tasks.load()->put(t, thid, owner);
 }
 
 /** Adds given thread ID to task collections */
@@ -173,16 +255,23 @@ Scheduler::Scheduler(const Node &node)
 	: _node(node)
 	, _msource(MemSource::forNode(node))
 	, _domain(_msource.construct<SchedulingDomain>(_msource))
+	, _shared(_msource.construct<SchedulingDomain>(_msource))
 	, _workers(_msource)
+	, _task_pools(_msource)
+	, _parked(_msource)
+	, _parked_count(0)
 	, _ctx_cache(_msource)
 {
 	std::vector<CpuId> cpus = node.cpuids();
 	_cores = cpus.size();
 	_workers.resize(_cores, nullptr);
+	_task_pools.resize(_cores, nullptr);
 
-	_waitingThreadsCount = 0;
-	if (sem_init(&_waitingThreadsSemaphore, 0, 0) != 0) {
-		assert(false);
+	// nodes to steal from
+	const StealPolicy &policy = StealPolicy::get();
+	for (const Node &n : node.nearestNeighborsWithCPUs()) {
+		if (_neighbors.size() == policy.max_neighbors) break;
+		if (n != node) _neighbors.push_back(n);
 	}
 
 	_thread_manager = ThreadManager::create(_node, cpus, _msource);
@@ -203,6 +292,7 @@ Scheduler::~Scheduler() {
 			_workers[i] = nullptr;
 			if (tmpworkers[i] != nullptr) {
 				_domain->remove_thread(i);
+				_shared->remove_thread(i);
 				tmpworkers[i]->shutdown();
 				tmpworkers[i]->notify();
 			}
@@ -210,8 +300,7 @@ Scheduler::~Scheduler() {
 	}
 
 	// notify all workers, if they are sleeping
-	for (size_t i = 0; i < _workers.size(); i++)
-		taskAvailable();
+	while (taskAvailable(-1)) {}
 
 	// shutdown thread manager; wait for threads to complete
 	_thread_manager->deregister_all();
@@ -223,10 +312,7 @@ Scheduler::~Scheduler() {
 	}
 
 	MemSource::destruct(_domain);
-
-	if (sem_destroy(&_waitingThreadsSemaphore) != 0) {
-		assert(false);
-	}
+	MemSource::destruct(_shared);
 }
 
 Scheduler* Scheduler::get_scheduler(const Node &node) {
@@ -243,9 +329,14 @@ WorkerThread* Scheduler::create_thread(int core) {
 	assert(core >= 0 && core < _cores);
 	assert(_workers[core] == nullptr);
 
+	// pools are never destroyed, tasks may outlive their workers
+	if (_task_pools[core] == nullptr)
+		_task_pools[core] = _msource.construct<TaskPool>(_msource);
+
 	WorkerThread *th = _msource.construct<WorkerThread>(core, this, _msource);
 
 	_domain->add_thread(core);
+	_shared->add_thread(core);
 	_workers[core] = th;
 
 	_thread_manager->register_thread(th, core);
@@ -267,6 +358,7 @@ void Scheduler::stop_wait_thread(int core) {
 	WorkerThread *th = _workers[core];
 	_workers[core] = nullptr;
 	_domain->remove_thread(core);
+	_shared->remove_thread(core);
 
 	// shutdown thread
 	th->shutdown();
@@ -345,39 +437,64 @@ std::vector<int> Scheduler::worker_ids() {
 }
 
 /**
- * Wake N threads from their sleep
+ * Wake one sleeping worker for a new task, preferably thid. Returns
+ * false if no worker was sleeping
  */
-void Scheduler::taskAvailable() {
-	if (_waitingThreadsCount.load() > 0) {
-		size_t old = _waitingThreadsCount.exchange(0);
-
-		for (size_t i = 0; i < old; i++) {
-			sem_post(&_waitingThreadsSemaphore);
-		}
+bool Scheduler::taskAvailable(int thid) {
+	// pairs with the fence in park(): either the worker sees the new task,
+	// or we see the worker
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (_parked_count.load(std::memory_order_relaxed) == 0)
+		return false;
+
+	WorkerThread *th;
+	{
+		std::lock_guard<Lock> lock(_parked_lock);
+		if (_parked.empty())
+			return false;
+
+		// the thread the task is bound to, or the one that slept the shortest
+		auto it = std::find_if(_parked.begin(), _parked.end(),
+			[thid] (WorkerThread *w) { return w->id() == thid; });
+		if (it == _parked.end())
+			--it;
+
+		th = *it;
+		_parked.erase(it);
+		_parked_count -= 1;
 	}
+
+	th->notify();
+	return true;
 }
 
 /**
- * Wait for a while for a task to be available
+ * Register the calling worker as sleeping. It must look for tasks once
+ * more before it actually sleeps, to not miss a wakeup
  */
-void Scheduler::waitForTask(size_t usec) {
-	// slow path: register and wait for a while on a semaphore
-	_waitingThreadsCount++;
-
-	// get current time
-	struct timeval currTime;
-	gettimeofday(&currTime, 0);
-
-	// dest. time
-	struct timespec waitTime;
-	waitTime.tv_sec = currTime.tv_sec;
-	waitTime.tv_nsec = 1000 * (currTime.tv_usec + usec);
-	if (waitTime.tv_nsec > 1000000000) {
-		waitTime.tv_nsec -= 1000000000;
-		waitTime.tv_sec += 1;
+void Scheduler::park(WorkerThread *th) {
+	{
+		std::lock_guard<Lock> lock(_parked_lock);
+		_parked.push_back(th);
+		_parked_count += 1;
 	}
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/**
+ * Deregister a sleeping worker. Returns false if it has already been
+ * woken for a task
+ */
+bool Scheduler::unpark(WorkerThread *th) {
+	std::lock_guard<Lock> lock(_parked_lock);
 
-	sem_timedwait(&_waitingThreadsSemaphore, &waitTime);
+	auto it = std::find(_parked.begin(), _parked.end(), th);
+	if (it == _parked.end())
+		return false;
+
+	_parked.erase(it);
+	_parked_count -= 1;
+	return true;
 }
 
 /**
@@ -388,8 +505,11 @@ void Scheduler::spawn_task(Scheduler *sched, Task *task) {
 	if (sched == nullptr) {
 		globalDomain()->put_task(task, -1);
 
-		for (const Node &node : NodeList::logicalNodesWithCPUs())
-			getNodeSchedulers().get(node).taskAvailable();
+		// one worker anywhere is enough
+		for (const Node &node : NodeList::logicalNodesWithCPUs()) {
+			if (getNodeSchedulers().get(node).taskAvailable(-1))
+				break;
+		}
 	}
 	// local?
 	else {
@@ -402,11 +522,52 @@ void Scheduler::spawn_task(Scheduler *sched, Task *task) {
 }
 
 /**
- * Returns a task ready for execution from local or global scheduling domains
+ * Take a task that may migrate from the nearest neighbor node with enough
+ * of them queued, if any
+ */
+Task* Scheduler::steal_from_neighbors() {
+	const StealPolicy &policy = StealPolicy::get();
+
+	for (size_t rank = 0; rank < _neighbors.size(); rank++) {
+		// don't create schedulers just to look into them
+		Scheduler *victim = getNodeSchedulers().try_get(_neighbors[rank]);
+		if (victim == nullptr || victim->_shared->queued() <= policy.threshold(rank))
+			continue;
+
+		// we are no worker of the victim, so only steal
+		Task *t = victim->_shared->try_get_task(-1);
+		if (t != nullptr)
+			return t;
+	}
+	return nullptr;
+}
+
+/**
+ * Returns a task ready for execution: the highest-priority one of the own
+ * node, local tasks first within a priority. Else from neighbor nodes or the
+ * global scheduling domain, in this order
  */
 Task* Scheduler::try_get_task(int thid) {
 	// fast path: try to get directly
-	Task *t = _domain->try_get_task(thid);
+	uint64_t local = _domain->occupied();
+	uint64_t shared = _shared->occupied();
+	while ((local | shared) != 0) {
+		const size_t idx = 63 - __builtin_clzll(local | shared);
+		const uint64_t bit = UINT64_C(1) << idx;
+
+		Task *t = nullptr;
+		if ((local & bit) != 0)
+			t = _domain->try_get_task(thid, idx);
+		if (t == nullptr && (shared & bit) != 0)
+			t = _shared->try_get_task(thid, idx);
+		if (t != nullptr)
+			return t;
+
+		local &= ~bit;
+		shared &= ~bit;
+	}
+
+	Task *t = steal_from_neighbors();
 	if (t != nullptr)
 		return t;
 	return globalDomain()->try_get_task(-1);
@@ -417,8 +578,13 @@ Task* Scheduler::try_get_task(int thid) {
  * global task queues. Else into scheduler's queue.
  */
 void Scheduler::put_task(Task* t, int thid) {
-	taskAvailable();
-	_domain->put_task(t, thid);
+	// only the worker thid itself may use its deque
+	WorkerThread *th = WorkerThread::curr_worker_thread();
+	bool owner = th != nullptr && th->scheduler() == this && th->id() == thid;
+
+	SchedulingDomain *dst = t->get_keep_scheduler() ? _domain : _shared;
+	dst->put_task(t, thid, owner);
+	taskAvailable(thid);
 }
 
 }
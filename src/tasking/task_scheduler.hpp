@@ -1,10 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <mutex>
-#include <semaphore.h>
 
 #include "PGASUS/PGASUS_export.h"
+#include "PGASUS/base/node.hpp"
 #include "PGASUS/base/spinlock.hpp"
 #include "PGASUS/msource/msource.hpp"
 #include "tasking/context.hpp"
@@ -15,10 +17,50 @@ namespace tasking {
 
 class Task;
 class TaskCollection;
+class TaskPool;
 class ThreadManager;
 class WorkerThread;
 
 
+/**
+ * Where idle workers look for tasks once their own node has none left: the
+ * nearest max_neighbors nodes with CPUs, in order of distance, then the global
+ * domain. Only tasks without KEEP_SCHEDULER are taken from other nodes, and
+ * only from a node with more than thresholds[rank] such tasks queued. The
+ * last threshold applies to all farther nodes.
+ *
+ * Read once from NUMA_STEAL_NEIGHBORS (default: all nodes) and
+ * NUMA_STEAL_THRESHOLDS (comma-separated, default "1,4").
+ */
+struct StealPolicy
+{
+	size_t                      max_neighbors;
+	std::vector<size_t>         thresholds;
+
+	static const StealPolicy& get();
+
+	inline size_t threshold(size_t rank) const {
+		return thresholds[std::min(rank, thresholds.size() - 1)];
+	}
+};
+
+
+/**
+ * What idle workers do: poll for tasks spin_polls times with growing
+ * back-off, then park until a new task wakes them or park_usec have passed.
+ *
+ * Read once from NUMA_IDLE_SPIN (default 8, 0 parks right away) and
+ * NUMA_IDLE_PARK_USEC (default 10000).
+ */
+struct IdlePolicy
+{
+	size_t                      spin_polls;
+	size_t                      park_usec;
+
+	static const IdlePolicy& get();
+};
+
+
 /**
  * Encapsulates all priorities within one scheduling domain
  */
@@ -31,7 +73,7 @@ private:
 	/*
 	 * For each priority level we keep one TaskList (lazily initialized) within
 	 * a vector. All active (= containing more than zero tasks) task lists
-	 * are additionaly stored in a linked list 
+	 * are additionaly marked in a bitmap
 	 */
 	struct PriorityTasks
 	{
@@ -53,9 +95,11 @@ private:
 	Lock                        _active_thread_ids_mutex;	// mutex for access
 	mslist<int>                 _active_thread_ids;
 	
-	std::atomic<size_t>         _topPriorityIdx;			// currently
+	std::atomic<uint64_t>       _occupied;				// bit i: priority index i has tasks
 	msvector<PriorityTasks>     _priorities;				// all priorities
 
+	static_assert(Priority::max_index() < 64, "priorities must fit the occupancy bitmap");
+
 public:
 
 	explicit SchedulingDomain(const numa::MemSource &ms);
@@ -66,11 +110,26 @@ public:
 	 * Always picks the highest-priority task. Prefers tasks bound to that thid
 	 */
 	Task* try_get_task(int thid);
+
+	/**
+	 * Returns a task of the given priority index, or null. Prefers tasks
+	 * bound to that thid
+	 */
+	Task* try_get_task(int thid, size_t idx);
+
+	/** Bit i is set if priority index i may have tasks */
+	inline uint64_t occupied() const { return _occupied.load(); }
+	
+	/**
+	 * Number of tasks in this domain, for steal decisions
+	 */
+	size_t queued() const;
 	
 	/**
-	 * Inserts a task into this scheduling domain
+	 * Inserts a task into this scheduling domain. Set owner if the calling
+	 * thread is thid itself.
 	 */
-	void put_task(Task *task, int thid);
+	void put_task(Task *task, int thid, bool owner = false);
 	
 	/** Adds given thread ID to task collections */
 	void add_thread(int idx);
@@ -96,20 +155,27 @@ private:
 	numa::MemSource             _msource;				// local memory allocator
 	
 	/**
-	 * Local+Global tasks
+	 * Local tasks, and those that may be stolen by other nodes' workers
 	 */
 	SchedulingDomain           *_domain;
+	SchedulingDomain           *_shared;
+	
+	/** Nodes to steal from, nearest first */
+	NodeList                    _neighbors;
 	
 	/**
 	 * Worker threads working on this node scheduler are referenced by their
 	 * node-relative core numbers, starting at 0.
 	 */
 	msvector<WorkerThread*>     _workers;	// core to worker (or null)
+	msvector<TaskPool*>         _task_pools;	// core to pool, kept with no worker
 	std::recursive_mutex        _workers_lock;
 	ThreadManager              *_thread_manager;
 
-	std::atomic<size_t>         _waitingThreadsCount;
-	sem_t                       _waitingThreadsSemaphore;
+	/** Workers sleeping until a task is available */
+	Lock                        _parked_lock;
+	msvector<WorkerThread*>     _parked;
+	std::atomic<size_t>         _parked_count;
 	
 	ContextCache                _ctx_cache;
 
@@ -128,9 +194,10 @@ private:
 	void stop_wait_thread(int core);
 
 	/**
-	 * Wake N threads from their sleep
+	 * Take a task that may migrate from the nearest neighbor node with enough
+	 * of them queued, if any
 	 */
-	void taskAvailable();
+	Task* steal_from_neighbors();
 	
 	
 public:
@@ -138,6 +205,7 @@ public:
 	~Scheduler();
 	
 	inline ContextCache& context_cache() { return _ctx_cache; }
+	inline TaskPool* task_pool(int core) const { return _task_pools[core]; }
 	inline Node node() const { return _node; }
 	
 	/**
@@ -166,7 +234,9 @@ public:
 	std::vector<int> worker_ids();
 	
 	/**
-	 * Returns a task ready for execution from local or global scheduling domains
+	 * Returns a task ready for execution: the highest-priority one of the own
+	 * node, local tasks first within a priority. Else from neighbor nodes or
+	 * the global scheduling domain, in this order
 	 */
 	Task* try_get_task(int thid);
 	
@@ -177,9 +247,22 @@ public:
 	void put_task(Task* t, int thid);
 
 	/**
-	 * Wait for a while for a task to be available
+	 * Wake one sleeping worker for a new task, preferably thid. Returns
+	 * false if no worker was sleeping
+	 */
+	bool taskAvailable(int thid);
+	
+	/**
+	 * Register the calling worker as sleeping. It must look for tasks once
+	 * more before it actually sleeps, to not miss a wakeup
+	 */
+	void park(WorkerThread *th);
+
+	/**
+	 * Deregister a sleeping worker. Returns false if it has already been
+	 * woken for a task
 	 */
-	void waitForTask(size_t usec);
+	bool unpark(WorkerThread *th);
 };
 
 
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <sys/types.h>
+
+#include "PGASUS/msource/msource_types.hpp"
+
+
+namespace numa {
+namespace tasking {
+
+
+/**
+ * Chase-Lev work-stealing deque of pointers, with the memory orderings of
+ * Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models".
+ *
+ * Only the owning thread may push() and pop(), which work LIFO on the bottom
+ * end and take no lock and no read-modify-write, except when popping the
+ * last element. Any thread may steal() from the top end, FIFO, with a CAS.
+ *
+ * Storage comes from the given MemSource. The ring buffer doubles when full;
+ * replaced buffers may still be read by concurrent thieves and are freed
+ * only with the deque.
+ */
+template <class T>
+class WorkStealingDeque
+{
+private:
+	struct Buffer {
+		size_t                  mask;
+		Buffer                 *retired;	// previous, smaller buffer
+
+		// slots follow the header
+		inline std::atomic<T*>& at(ssize_t i) {
+			return reinterpret_cast<std::atomic<T*>*>(this + 1)[(size_t)i & mask];
+		}
+	};
+
+	alignas(64) std::atomic<ssize_t> _top;
+	alignas(64) std::atomic<ssize_t> _bottom;
+	std::atomic<Buffer*>        _buffer;
+	numa::MemSource             _msource;
+
+	Buffer *create_buffer(size_t capacity, Buffer *retired) {
+		void *mem = _msource.alloc(sizeof(Buffer) + capacity * sizeof(std::atomic<T*>));
+		if (mem == nullptr)
+			throw std::bad_alloc();
+		Buffer *buf = static_cast<Buffer*>(mem);
+		buf->mask = capacity - 1;
+		buf->retired = retired;
+		return buf;
+	}
+
+	/**
+	 * Owner only: copy the elements [t, b) into a buffer of twice the size
+	 */
+	Buffer *grow(Buffer *old, ssize_t t, ssize_t b) {
+		Buffer *buf = create_buffer(2 * (old->mask + 1), old);
+		for (ssize_t i = t; i < b; i++)
+			buf->at(i).store(old->at(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+		_buffer.store(buf, std::memory_order_release);
+		return buf;
+	}
+
+public:
+	explicit WorkStealingDeque(const numa::MemSource &ms, size_t capacity = 256)
+		: _top(0)
+		, _bottom(0)
+		, _msource(ms)
+	{
+		size_t cap = 1;
+		while (cap < capacity) cap <<= 1;
+		_buffer.store(create_buffer(cap, nullptr), std::memory_order_relaxed);
+	}
+
+	WorkStealingDeque(const WorkStealingDeque &other) = delete;
+	WorkStealingDeque& operator=(const WorkStealingDeque &other) = delete;
+
+	~WorkStealingDeque() {
+		Buffer *buf = _buffer.load(std::memory_order_relaxed);
+		while (buf != nullptr) {
+			Buffer *next = buf->retired;
+			numa::MemSource::free(buf);
+			buf = next;
+		}
+	}
+
+	/**
+	 * Owner only: add an element at the bottom. Throws std::bad_alloc if the
+	 * buffer can't grow, leaving the deque as it was
+	 */
+	void push(T *v) {
+		ssize_t b = _bottom.load(std::memory_order_relaxed);
+		ssize_t t = _top.load(std::memory_order_acquire);
+		Buffer *buf = _buffer.load(std::memory_order_relaxed);
+
+		if (b - t > (ssize_t)buf->mask)
+			buf = grow(buf, t, b);
+
+		buf->at(b).store(v, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Owner only: remove the most recently pushed element, or return null
+	 */
+	T *pop() {
+		ssize_t b = _bottom.load(std::memory_order_relaxed) - 1;
+		Buffer *buf = _buffer.load(std::memory_order_relaxed);
+		_bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		ssize_t t = _top.load(std::memory_order_relaxed);
+
+		if (t > b) {
+			// was empty
+			_bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		T *v = buf->at(b).load(std::memory_order_relaxed);
+		if (t == b) {
+			// last element: race against thieves
+			if (!_top.compare_exchange_strong(t, t + 1,
+					std::memory_order_seq_cst, std::memory_order_relaxed))
+				v = nullptr;
+			_bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return v;
+	}
+
+	/**
+	 * Any thread: remove the oldest element, or return null if empty
+	 */
+	T *steal() {
+		ssize_t t = _top.load(std::memory_order_acquire);
+		for (;;) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			ssize_t b = _bottom.load(std::memory_order_acquire);
+			if (t >= b)
+				return nullptr;
+
+			Buffer *buf = _buffer.load(std::memory_order_acquire);
+			T *v = buf->at(t).load(std::memory_order_relaxed);
+			if (_top.compare_exchange_strong(t, t + 1,
+					std::memory_order_seq_cst, std::memory_order_relaxed))
+				return v;
+			// lost against another thief or the owner. t has been reloaded
+		}
+	}
+};
+
+
+}
+}
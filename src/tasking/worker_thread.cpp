@@ -5,7 +5,10 @@
 #include <list>
 #include <vector>
 
-#include <semaphore.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "PGASUS/base/spinlock.hpp"
 #include "PGASUS/msource/msource.hpp"
@@ -53,13 +56,12 @@ WorkerThread::WorkerThread(size_t id, Scheduler *sched, const MemSource &ms)
 	, _scheduler(sched)
 	, _thread_id(id)
 	, _node(sched->node())
+	, _task_pool(sched->task_pool(id))
 	, _curr_task(nullptr)
 	, _curr_ctx(nullptr)
 	, _ready_contexes(msource())
+	, _parked(0)
 {
-	if (sem_init(&_sleep, 0, 0) != 0) {
-		assert(false);
-	}
 	_done = 0;
 }
 
@@ -102,13 +104,12 @@ void WorkerThread::run() {
 WorkerThread::~WorkerThread() {
 	for (Context *c : _ready_contexes)
 		_scheduler->context_cache().store(c);
-	if (sem_destroy(&_sleep) != 0) {
-		assert(false);
-	}
 }
 
 inline Task *WorkerThread::get_new_task() {
+	const IdlePolicy &policy = IdlePolicy::get();
 	numa::LinearBackOff<256, 2048> bkoff;
+	size_t polls = 0;
 
 	while (_done.load() == 0) {
 		Task *t = _scheduler->try_get_task(_thread_id);
@@ -116,17 +117,52 @@ inline Task *WorkerThread::get_new_task() {
 			return t;
 
 		// wait a while before trying again.
-		if (!bkoff()) {
-			// if we waited long enough, go to sleep state
-			// and be either woken up by scheduler, or by timeout
-			_scheduler->waitForTask(10 * 1000);	// 10 msec
-			bkoff.reset();
+		if (polls < policy.spin_polls) {
+			bkoff();
+			polls++;
+			continue;
 		}
+
+		// if we waited long enough, go to sleep state and be either
+		// woken up by scheduler, or by timeout. look once more after
+		// registering, a task might have been put in between
+		_parked.store(1);
+		_scheduler->park(this);
+
+		t = _scheduler->try_get_task(_thread_id);
+		if (t == nullptr && _done.load() == 0)
+			sleep_parked(policy.park_usec);
+
+		bool woken = !_scheduler->unpark(this);
+		_parked.store(0);
+
+		if (t != nullptr) {
+			// pass on a wakeup that was meant for another task
+			if (woken)
+				_scheduler->taskAvailable(-1);
+			return t;
+		}
+
+		bkoff.reset();
+		polls = 0;
 	}
 
 	return nullptr;
 }
 
+/**
+ * Sleep until notify() or the timeout, if still parked
+ */
+void WorkerThread::sleep_parked(size_t usec) {
+	struct timespec timeout;
+	timeout.tv_sec = usec / 1000000;
+	timeout.tv_nsec = (usec % 1000000) * 1000;
+
+	// returns right away if notify() came first
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_parked), FUTEX_WAIT_PRIVATE,
+		1, &timeout, nullptr, 0);
+}
+
 inline Context *WorkerThread::get_neutral_context() {
 	if (!_ready_contexes.empty()) {
 		Context *result = _ready_contexes.back();
@@ -259,12 +295,13 @@ void WorkerThread::yield() {
 }
 
 /**
- * Gets called when the thread has registered as unemployed at its
+ * Wakes the thread, if it has registered as unemployed at its
  * local job center
  */
 void WorkerThread::notify() {
-	if (sem_post(&_sleep) != 0) {
-		assert(false);
+	if (_parked.exchange(0) != 0) {
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_parked), FUTEX_WAKE_PRIVATE,
+			1, nullptr, nullptr, 0);
 	}
 }
 
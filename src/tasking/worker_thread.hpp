@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 
 #include "PGASUS/PGASUS_export.h"
 #include "PGASUS/PGASUS-config.h"
@@ -18,6 +19,7 @@ namespace numa {
 namespace tasking {
 
 class Task;
+class TaskPool;
 
 
 /**
@@ -32,6 +34,7 @@ private:
 	Scheduler                  *_scheduler;
 	size_t                      _thread_id;
 	Node                        _node;
+	TaskPool                   *_task_pool;
 	
 	/** The Task the thread is currently working on */
 	Task                       *_curr_task;
@@ -50,7 +53,8 @@ private:
 	
 	std::atomic_int             _done;
 	
-	sem_t                       _sleep;
+	/** Futex word: whether the thread sleeps until notify() */
+	std::atomic<uint32_t>       _parked;
 	
 #if ENABLE_DEBUG_LOG && !PGASUS_PLATFORM_PPC64LE
 	/**
@@ -83,6 +87,7 @@ public:
 	inline Node homeNode() const { return _node; }
 	
 	inline Scheduler* scheduler() const { return _scheduler; }
+	inline TaskPool* task_pool() const { return _task_pool; }
 	
 protected:
 
@@ -92,6 +97,11 @@ private:
 
 	Task *get_new_task();
 	
+	/**
+	 * Sleep until notify() or the timeout, if still parked
+	 */
+	void sleep_parked(size_t usec);
+	
 	static void start_new_context(intptr_t tcb_ptr);
 	
 	inline Context *get_neutral_context();
@@ -128,7 +138,7 @@ public:
 	static void yield();
 	
 	/**
-	 * Gets called when the thread has registered as unemployed at its
+	 * Wakes the thread, if it has registered as unemployed at its
 	 * local job center
 	 */
 	void notify();
@@ -1,8 +1,11 @@
+#include <atomic>
 #include <ctime>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdlib>
+#include <cstring>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "PGASUS/base/node.hpp"
@@ -11,6 +14,9 @@
 #include "test_helper.h"
 
 
+// C23's free_sized(), from the replaced malloc if it provides one
+extern "C" void free_sized(void *p, size_t sz) __attribute__((weak));
+
 typedef std::vector<void*> Memories;
 typedef std::vector<int> MemSizes;
 using numa::MemSource;
@@ -39,10 +45,15 @@ Memories fill(MemSource src, const MemSizes &mems) {
 void printInfo(MemSource src) {
 	numa::msource_info info = src.stats();
 	
-	printf("Space [%s]: %zu arenas (%zu alloc, %zu used), %zu mmaps (%zu alloc, %zu used)\n",
+	printf("Space [%s]: %zu arenas (%zu alloc, %zu used, %zu released), %zu mmaps (%zu alloc, %zu used)\n",
 		src.getDescription().c_str(),
-		info.arena_count, info.arena_size, info.arena_used,
+		info.arena_count, info.arena_size, info.arena_used, info.arena_released,
 		info.hugeobj_count, info.hugeobj_size, info.hugeobj_used);
+	printf("    %zu slab segments (%zu alloc, %zu used, %zu released)\n",
+		info.slab_count, info.slab_size, info.slab_used, info.slab_released);
+	printf("    %zu allocs, %zu frees (%zu remote), %zu live bytes, %zu peak bytes\n",
+		info.alloc_count, info.free_count, info.remote_free_count,
+		info.live_bytes, info.peak_bytes);
 }
 
 
@@ -67,10 +78,141 @@ int main (int argc, char const* argv[])
 		MemSource::free(mems[i]);
 		
 	printInfo(msrc);
+	Memories refill = fill(msrc, sizes);
 	fill(msrc, sizes);
 	fill(msrc, sizes);
-	fill(msrc, sizes);
 	printInfo(msrc);
+
+	for (void *p : refill)
+		MemSource::free(p);
+	printf("Trimmed %zu bytes\n", msrc.trim());
+	printInfo(msrc);
+	printf("Prefaulted %zu of %d bytes\n", msrc.prefault(64 << 20), 64 << 20);
+	printInfo(msrc);
+
+	// grow a block in its arena, then past the mmap threshold
+	void *block = msrc.alloc(256);
+	size_t resized = 0;
+	for (size_t sz = 512; sz <= (64 << 20); sz *= 2) {
+		void *p = MemSource::resize(block, sz);
+		if (p == nullptr) {
+			p = msrc.alloc(sz);
+			memcpy(p, block, MemSource::allocatedSize(block));
+			MemSource::free(block);
+		} else {
+			resized++;
+		}
+		block = p;
+	}
+	printf("Resized %zu of 18 times without copying, block has %zu bytes\n",
+		resized, MemSource::allocatedSize(block));
+	MemSource::free(block);
+
+	// shrink a small block into a smaller size class, then free it by its
+	// new size
+	if (free_sized != nullptr) {
+		void *shrunk = realloc(malloc(200), 40);
+		free_sized(shrunk, 40);
+		printf("Freed a shrunk block by its new size\n");
+	}
+
+	// look up nodes by interior pointers, one by one and in a batch
+	const size_t lookup_sizes[] = { 24, 4096, 64 << 20 };
+	const void *interior[3];
+	void *lookup_blocks[3];
+	size_t matches = 0;
+	for (size_t i = 0; i < 3; i++) {
+		lookup_blocks[i] = msrc.alloc(lookup_sizes[i]);
+		interior[i] = (char*) lookup_blocks[i] + lookup_sizes[i] - 1;
+		if (MemSource::nodeOf(interior[i]) == msrc.getLogicalNode())
+			matches++;
+	}
+	numa::Node lookup_nodes[3];
+	MemSource::getNodesOf(interior, 3, lookup_nodes);
+	for (size_t i = 0; i < 3; i++) {
+		if (lookup_nodes[i] == msrc.getLogicalNode())
+			matches++;
+		MemSource::free(lookup_blocks[i]);
+	}
+	printf("Found node of %zu of 6 interior pointers\n", matches);
+
+	// sample every allocation, then free half of the blocks
+	MemSource::setTraceSampling(1);
+	Memories traced;
+	for (size_t i = 0; i < 64; i++)
+		traced.push_back(msrc.alloc(32 + i));
+	MemSource::setTraceSampling(0);
+	for (size_t i = 0; i < traced.size(); i += 2)
+		MemSource::free(traced[i]);
+	size_t samples = 0, live_samples = 0;
+	for (const numa::msource_trace_site &site : msrc.traceSites()) {
+		samples += site.samples;
+		live_samples += site.live_samples;
+	}
+	printf("Traced %zu allocations, %zu still live\n", samples, live_samples);
+	msrc.traceReport(stdout);
+	for (size_t i = 1; i < traced.size(); i += 2)
+		MemSource::free(traced[i]);
+
+	// bump blocks from a region, grow the last one in place, then start over
+	MemSource region = MemSource::createRegion(numa::Node::curr().physicalId(), 1 << 20, "region");
+	for (int phase = 0; phase < 3; phase++) {
+		void *first = region.alloc(48);
+		for (size_t i = 0; i < 100000; i++)
+			MemSource::free(region.alloc(16 + i % 200));
+		void *last = region.alloc(64);
+		const bool grown = MemSource::resize(last, 4096) == last;
+		const numa::msource_info info = region.stats();
+		printf("Region phase %d: first block %p, last block %sgrown in place, "
+			"%zu bytes in %zu chunks (%zu bytes)\n", phase, first, grown ? "" : "not ",
+			info.region_size, info.region_count, info.region_used);
+		region.reset();
+	}
+
+	// region blocks don't keep their region alive, and may be freed after it
+	void *orphans[2];
+	{
+		MemSource scratch = MemSource::createRegion(numa::Node::curr().physicalId(), 1 << 20, "scratch");
+		orphans[0] = scratch.alloc(100);
+		orphans[1] = scratch.alloc(5000);
+	}
+	MemSource::free(orphans[0]);
+	MemSource::freeSized(orphans[1], 5000);
+	printf("Freed blocks of a destroyed region\n");
+
+	// drop the last handle while several threads free the blocks, the last
+	// free must destroy each source exactly once
+	for (int round = 0; round < 200; round++) {
+		MemSource src = MemSource::create(numa::Node::curr().physicalId(), 1 << 20, "abandoned");
+		Memories blocks;
+		for (size_t i = 0; i < 1024; i++)
+			blocks.push_back(src.alloc(16 + (i * 37) % 2048));
+
+		std::atomic_bool go(false);
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < 4; t++) {
+			threads.emplace_back([&blocks, &go, t] {
+				while (!go)
+					std::this_thread::yield();
+				for (size_t i = t; i < blocks.size(); i += 4)
+					MemSource::free(blocks[i]);
+			});
+		}
+		go = true;
+		src = MemSource();
+		for (std::thread &thread : threads)
+			thread.join();
+	}
+
+	size_t abandoned = 0;
+	for (const numa::msource_snapshot &snap : MemSource::snapshotAll()) {
+		if (strcmp(snap.description, "abandoned") == 0)
+			abandoned++;
+		else
+			printf("Source [%s] on node %d: %zu live bytes\n", snap.description, snap.node,
+				snap.info.live_bytes);
+	}
+	printf("Abandoned 200 sources while freeing their blocks, %zu not destroyed\n", abandoned);
 	
 	return 0;
 }